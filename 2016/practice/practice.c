@@ -1,8 +1,25 @@
+#define _GNU_SOURCE // clock_gettime() and syscall() for --bench
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BITCANVAS_KERNEL_X86
+#endif
 
 enum command_type {
     PAINT_LINE,
@@ -15,135 +32,629 @@ struct command {
     enum command_type type;
     union {
         struct {
-            size_t x1;
-            size_t y1;
-            size_t x2;
-            size_t y2;
+            uint32_t x1;
+            uint32_t y1;
+            uint32_t x2;
+            uint32_t y2;
         } line;
         struct {
-            size_t x;
-            size_t y;
-            size_t s;
+            uint32_t x;
+            uint32_t y;
+            uint32_t s;
         } square;
         struct {
-            size_t x;
-            size_t y;
+            uint32_t x;
+            uint32_t y;
         } erase;
     } data;
-    struct command* next;
 };
 
+// The commands in the order they're given, one after the other in a single
+// allocation that doubles when it gets full.
 struct command_list {
-    struct command* head;
-    struct command* tail;
+    struct command* commands;
     size_t len;
+    size_t cap;
 };
 
-#define COMMAND_LIST_INITIALIZER {NULL, NULL, 0}
+#define COMMAND_LIST_INITIALIZER {NULL, 0, 0}
+
+void command_list_add(struct command_list* l, const struct command* c) {
+    if (l->len == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 1024;
+        l->commands = realloc(l->commands, l->cap * sizeof(struct command));
+        assert(l->commands);
+    }
+    l->commands[l->len++] = *c;
+}
+
+void command_list_free(struct command_list* l) {
+    free(l->commands);
+}
 
-void command_list_add_owned(struct command_list* l, struct command* c) {
-    // This assumes c has no linked nodes
-    assert(!c->next);
+// Longest line a command takes once formatted: "PAINT_LINE " and four
+// numbers of up to ten digits, with their separators.
+#define MAX_FORMATTED_COMMAND 64
 
-    if (l->head == NULL) {
-        assert(!l->tail);
-        l->head = l->tail = c;
+// Writes `value` in decimal at `out`, two digits at a time, and returns
+// where it ends.
+char* format_uint(char* out, uint64_t value) {
+    static const char pairs[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+    char digits[20];
+    char* start = digits + sizeof(digits);
+    while (value >= 100) {
+        size_t pair = (value % 100) * 2;
+        value /= 100;
+        *--start = pairs[pair + 1];
+        *--start = pairs[pair];
+    }
+    if (value >= 10) {
+        *--start = pairs[value * 2 + 1];
+        *--start = pairs[value * 2];
     } else {
-        l->tail->next = c;
-        l->tail = c;
+        *--start = '0' + value;
     }
-    l->len++;
+    size_t len = digits + sizeof(digits) - start;
+    memcpy(out, start, len);
+    return out + len;
 }
 
-void command_list_add(struct command_list* l, struct command* non_owned) {
-    struct command* c = malloc(sizeof(struct command));
-    assert(c);
+char* format_string(char* out, const char* s) {
+    size_t len = strlen(s);
+    memcpy(out, s, len);
+    return out + len;
+}
 
-    *c = *non_owned;
-    c->next = NULL;
+// A canvas with a bit per cell, 64 cells per word. Every row starts on a
+// word of its own, so a range of a row is a run of whole words with a partial
+// one at each end. The bits past the end of a row stay 0, so whole rows can
+// be counted and compared word by word.
+struct bitcanvas {
+    size_t w;
+    size_t h;
+    size_t stride; // Words per row
+    uint64_t* words;
+};
 
-    command_list_add_owned(l, c);
+void bitcanvas_init(struct bitcanvas* c, size_t w, size_t h) {
+    c->w = w;
+    c->h = h;
+    c->stride = (w + 63) / 64;
+    c->words = calloc(c->stride * h, sizeof(uint64_t));
+    assert(c->words);
 }
 
-void command_list_free(struct command_list* l) {
-    struct command* c = l->head;
-    struct command* prev;
-    while (c) {
-        prev = c;
-        c = c->next;
+void bitcanvas_free(struct bitcanvas* c) {
+    free(c->words);
+}
 
-        free(prev);
+bool bitcanvas_get(const struct bitcanvas* c, size_t x, size_t y) {
+    assert(x < c->w);
+    assert(y < c->h);
+    return (c->words[y * c->stride + x / 64] >> (x % 64)) & 1;
+}
+
+void bitcanvas_set(struct bitcanvas* c, size_t x, size_t y, bool value) {
+    assert(x < c->w);
+    assert(y < c->h);
+    uint64_t* word = &c->words[y * c->stride + x / 64];
+    uint64_t bit = (uint64_t)1 << (x % 64);
+    *word = value ? *word | bit : *word & ~bit;
+}
+
+// The bits [from, to) of a word, with from < to <= 64.
+uint64_t word_mask(size_t from, size_t to) {
+    assert(from < to && to <= 64);
+    uint64_t mask = ~(uint64_t)0 << from;
+    if (to < 64)
+        mask &= ((uint64_t)1 << to) - 1;
+    return mask;
+}
+
+// Sets the cells of the word `word` of row `y` in `mask`. Returns the ones
+// that weren't set already.
+uint64_t bitcanvas_fill_word(struct bitcanvas* c, size_t word, size_t y, uint64_t mask) {
+    assert(word < c->stride);
+    assert(y < c->h);
+    uint64_t* target = &c->words[y * c->stride + word];
+    uint64_t fresh = mask & ~*target;
+    *target |= mask;
+    return fresh;
+}
+
+// The first set cell of row `y` in [from, to), if any.
+bool bitcanvas_next_set(const struct bitcanvas* c, size_t y,
+                        size_t from, size_t to, size_t* x) {
+    assert(to <= c->w);
+    assert(y < c->h);
+    const uint64_t* row = c->words + y * c->stride;
+    while (from < to) {
+        uint64_t bits = row[from / 64] & (~(uint64_t)0 << (from % 64));
+        if (bits) {
+            size_t found = from / 64 * 64 + __builtin_ctzll(bits);
+            if (found >= to)
+                return false;
+            *x = found;
+            return true;
+        }
+        from = from / 64 * 64 + 64;
     }
+    return false;
 }
 
-size_t line_to_right_len(uint8_t* grid,
-                         uint8_t* already_painted,
-                         size_t w, size_t h,
-                         size_t x, size_t y,
-                         size_t* wasted) {
-    size_t size = 1;
+// Where the run of set cells of row `y` starting at `x` ends.
+size_t bitcanvas_run_end(const struct bitcanvas* c, size_t y, size_t x) {
+    assert(x < c->w);
+    assert(y < c->h);
+    const uint64_t* row = c->words + y * c->stride;
+    while (x < c->w) {
+        uint64_t clear = ~row[x / 64] & (~(uint64_t)0 << (x % 64));
+        if (clear) {
+            size_t end = x / 64 * 64 + __builtin_ctzll(clear);
+            return end < c->w ? end : c->w;
+        }
+        x = x / 64 * 64 + 64;
+    }
+    return c->w;
+}
 
-    *wasted = 0;
+// Sets the `len` cells of row `y` from `x` on.
+void bitcanvas_fill_row(struct bitcanvas* c, size_t x, size_t y, size_t len) {
+    assert(len);
+    assert(x + len <= c->w);
+    size_t first = x / 64, last = (x + len - 1) / 64;
+    for (size_t word = first; word <= last; ++word) {
+        size_t from = word == first ? x % 64 : 0;
+        size_t to = word == last ? (x + len - 1) % 64 + 1 : 64;
+        bitcanvas_fill_word(c, word, y, word_mask(from, to));
+    }
+}
 
-    assert(x < w);
-    assert(y < h);
-    assert(grid[y * w + x]);
-    assert(!already_painted[y * w + x]);
+// Initializes `out` with the cells of `c`, swapping x and y.
+void bitcanvas_transpose(const struct bitcanvas* c, struct bitcanvas* out) {
+    bitcanvas_init(out, c->h, c->w);
+    for (size_t y = 0; y < c->h; ++y) {
+        size_t x = 0;
+        while (bitcanvas_next_set(c, y, x, c->w, &x)) {
+            bitcanvas_set(out, y, x, true);
+            x++;
+        }
+    }
+}
+
+// Kernels over `n` whole words: how many bits are set, in `a` or in `a & b`
+// if `b` isn't NULL, and whether `a` and `b` are the same. The AVX2 ones
+// count a nibble at a time with a shuffle as lookup table, 32 bytes at once.
+size_t count_words_scalar(const uint64_t* a, const uint64_t* b, size_t n) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; ++i)
+        count += __builtin_popcountll(b ? a[i] & b[i] : a[i]);
+    return count;
+}
 
-    while (x + size < w) {
-       if (!grid[y * w + x + size])
-           break;
+bool equal_words_scalar(const uint64_t* a, const uint64_t* b, size_t n) {
+    return memcmp(a, b, n * sizeof(uint64_t)) == 0;
+}
 
-       if (already_painted[y * w + x + size])
-           *wasted += 1;
+#ifdef BITCANVAS_KERNEL_X86
+__attribute__((target("avx2,popcnt")))
+size_t count_words_avx2(const uint64_t* a, const uint64_t* b, size_t n) {
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_nibbles = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i sums = zero;
 
-       size++;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(a + i));
+        if (b)
+            v = _mm256_and_si256(v, _mm256_loadu_si256((const __m256i*)(b + i)));
+        __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low_nibbles));
+        __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibbles));
+        sums = _mm256_add_epi64(sums, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), zero));
     }
 
-    return size;
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, sums);
+    size_t count = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; i < n; ++i)
+        count += __builtin_popcountll(b ? a[i] & b[i] : a[i]);
+    return count;
 }
 
-size_t line_to_bottom_len(uint8_t* grid,
-                          uint8_t* already_painted,
-                          size_t w, size_t h,
-                          size_t x, size_t y,
-                          size_t* wasted) {
-    size_t size = 1;
+__attribute__((target("avx2")))
+bool equal_words_avx2(const uint64_t* a, const uint64_t* b, size_t n) {
+    __m256i diff = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        diff = _mm256_or_si256(diff, _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i)),
+                                                      _mm256_loadu_si256((const __m256i*)(b + i))));
+    }
+    return _mm256_testz_si256(diff, diff) && equal_words_scalar(a + i, b + i, n - i);
+}
+#endif
 
-    *wasted = 0;
+size_t (*count_words)(const uint64_t* a, const uint64_t* b, size_t n) = count_words_scalar;
+bool (*equal_words)(const uint64_t* a, const uint64_t* b, size_t n) = equal_words_scalar;
 
-    assert(x < w);
-    assert(y < h);
-    assert(grid[y * w + x]);
-    assert(!already_painted[y * w + x]);
+// Picks the widest kernels the CPU we're running on supports.
+void bitcanvas_select_kernels(void) {
+#ifdef BITCANVAS_KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        count_words = count_words_avx2;
+        equal_words = equal_words_avx2;
+    }
+#endif
+}
+
+// Cells set in the `cw` x `ch` rectangle at (x, y), of `a`, or of both `a`
+// and `b` if `b` isn't NULL.
+size_t bitcanvas_count_and(const struct bitcanvas* a, const struct bitcanvas* b,
+                           size_t x, size_t y, size_t cw, size_t ch) {
+    assert(x + cw <= a->w);
+    assert(y + ch <= a->h);
+    assert(!b || (b->w == a->w && b->h == a->h));
+    if (!cw)
+        return 0;
+
+    size_t first = x / 64, last = (x + cw - 1) / 64;
+    uint64_t first_mask = word_mask(x % 64, first == last ? (x + cw - 1) % 64 + 1 : 64);
+    uint64_t last_mask = word_mask(0, (x + cw - 1) % 64 + 1);
+    size_t count = 0;
+    for (size_t row = y; row < y + ch; ++row) {
+        const uint64_t* wa = a->words + row * a->stride;
+        const uint64_t* wb = b ? b->words + row * b->stride : NULL;
+        count += __builtin_popcountll((wb ? wa[first] & wb[first] : wa[first]) & first_mask);
+        if (first == last)
+            continue;
+        if (last - first > 1)
+            count += count_words(wa + first + 1, wb ? wb + first + 1 : NULL, last - first - 1);
+        count += __builtin_popcountll((wb ? wa[last] & wb[last] : wa[last]) & last_mask);
+    }
+    return count;
+}
+
+size_t bitcanvas_count(const struct bitcanvas* c,
+                       size_t x, size_t y, size_t cw, size_t ch) {
+    return bitcanvas_count_and(c, NULL, x, y, cw, ch);
+}
+
+bool bitcanvas_eq(const struct bitcanvas* a, const struct bitcanvas* b) {
+    return a->w == b->w && a->h == b->h &&
+           equal_words(a->words, b->words, a->stride * a->h);
+}
+
+// Everything the greedy asks about the canvas, answered without walking it
+// cell by cell, in about a byte per cell on top of the canvases:
+//
+//  - How many cells of a rectangle should be painted. `painting` never
+//    changes, so there's a summed-area table for it, but only on every
+//    CANVAS_INDEX_BLOCK-th row. The whole blocks of rows in the rectangle
+//    come from it, and the few rows above and below them get counted with
+//    popcount.
+//  - How many of them are painted already: for small rectangles, like most
+//    lines, counting the bits of `already_painted` is cheapest. For larger
+//    ones there's a 2D Fenwick tree over blocks of rows and single columns,
+//    with the rows left over counted like above. The tree only gets brought
+//    up to date when it's asked, since most commands are followed by no
+//    such query. The cells that changed since are kept in `pending`, until
+//    there are so many that rebuilding the tree is cheaper.
+//  - How long the run of cells to paint starting at a cell is, to the right
+//    and to the bottom: a scan of the words of `painting`, or of its
+//    transpose, for the first cell that shouldn't be.
+//
+// `already_painted` must only be changed through canvas_index_paint(),
+// canvas_index_paint_row() and canvas_index_erase(), so the tree keeps up.
+struct canvas_index {
+    size_t w;
+    size_t h;
+    size_t blocks;           // Whole blocks of rows
+    const struct bitcanvas* painting;
+    struct bitcanvas painting_transposed;
+    struct bitcanvas* already_painted;
+    uint32_t* painting_sums; // (blocks + 1) * (w + 1), with a row and column of 0s
+    uint32_t* painted_tree;  // blocks * w
+    int32_t* pending;        // Cell index + 1, negated if it got erased
+    size_t pending_len;
+    size_t pending_cap;
+    bool tree_stale;         // Too many pending, rebuild the tree instead
+};
+
+// Rows per entry of the tables.
+#define CANVAS_INDEX_BLOCK 16
+
+// Above this many words (rows times words per row), a count of the cells
+// painted in a rectangle goes to the tree.
+#define CANVAS_INDEX_SCAN_WORDS 256
+
+void canvas_index_init(struct canvas_index* c,
+                       const struct bitcanvas* painting,
+                       struct bitcanvas* already_painted) {
+    size_t w = painting->w, h = painting->h;
+    assert(already_painted->w == w && already_painted->h == h);
+    assert(!bitcanvas_count(already_painted, 0, 0, w, h));
+
+    c->w = w;
+    c->h = h;
+    c->blocks = h / CANVAS_INDEX_BLOCK;
+    c->painting = painting;
+    c->already_painted = already_painted;
+    bitcanvas_transpose(painting, &c->painting_transposed);
+    c->painting_sums = calloc((c->blocks + 1) * (w + 1), sizeof(uint32_t));
+    c->painted_tree = calloc(c->blocks ? c->blocks * w : 1, sizeof(uint32_t));
+    // A point update costs about log(w) * log(blocks), a rebuild a pass
+    // over the words of the canvas and one over the tree.
+    c->pending_cap = w * h / 64 + 1;
+    c->pending_len = 0;
+    c->pending = malloc(c->pending_cap * sizeof(int32_t));
+    c->tree_stale = false;
+    assert(c->painting_sums && c->painted_tree && c->pending);
+
+    for (size_t b = 0; b < c->blocks; ++b) {
+        uint32_t* above = &c->painting_sums[b * (w + 1)];
+        uint32_t* sums = &c->painting_sums[(b + 1) * (w + 1)];
+        for (size_t x = 0; x < w; ++x) {
+            size_t column = bitcanvas_count(&c->painting_transposed, b * CANVAS_INDEX_BLOCK, x,
+                                            CANVAS_INDEX_BLOCK, 1);
+            sums[x + 1] = column + sums[x] + above[x + 1] - above[x];
+        }
+    }
+}
+
+void canvas_index_free(struct canvas_index* c) {
+    bitcanvas_free(&c->painting_transposed);
+    free(c->painting_sums);
+    free(c->painted_tree);
+    free(c->pending);
+}
+
+// The whole blocks of rows of [y, y + ch), as [first, last), and the rows
+// above and below them. No blocks means first == last, and all rows above.
+void canvas_index_split_rows(const struct canvas_index* c, size_t y, size_t ch,
+                             size_t* first, size_t* last,
+                             size_t* rows_above, size_t* rows_below) {
+    *first = (y + CANVAS_INDEX_BLOCK - 1) / CANVAS_INDEX_BLOCK;
+    *last = (y + ch) / CANVAS_INDEX_BLOCK;
+    if (*first >= *last) {
+        *first = *last = 0;
+        *rows_above = ch;
+        *rows_below = 0;
+        return;
+    }
+    assert(*last <= c->blocks);
+    *rows_above = *first * CANVAS_INDEX_BLOCK - y;
+    *rows_below = y + ch - *last * CANVAS_INDEX_BLOCK;
+}
+
+// Cells to paint in the `cw` x `ch` rectangle at (x, y).
+size_t canvas_index_to_paint(const struct canvas_index* c,
+                             size_t x, size_t y,
+                             size_t cw, size_t ch) {
+    assert(x + cw <= c->w);
+    assert(y + ch <= c->h);
+    if (!cw || !ch)
+        return 0;
+
+    size_t first, last, above, below;
+    canvas_index_split_rows(c, y, ch, &first, &last, &above, &below);
+    size_t count = bitcanvas_count(c->painting, x, y, cw, above) +
+                   bitcanvas_count(c->painting, x, y + ch - below, cw, below);
+    if (first == last)
+        return count;
+
+    const uint32_t* sums = c->painting_sums;
+    size_t stride = c->w + 1;
+    return count + sums[last * stride + x + cw] - sums[first * stride + x + cw] -
+           sums[last * stride + x] + sums[first * stride + x];
+}
 
-    while (y + size < h) {
-       if (!grid[(y + size) * w + x])
-           break;
+// Builds the tree from scratch, one axis at a time: each node adds itself to
+// its parent, first along the blocks, then along the columns.
+void canvas_index_rebuild_tree(struct canvas_index* c) {
+    size_t w = c->w, blocks = c->blocks;
+    uint32_t* tree = c->painted_tree;
+    memset(tree, 0, blocks * w * sizeof(uint32_t));
+    for (size_t y = 0; y < blocks * CANVAS_INDEX_BLOCK; ++y) {
+        const uint64_t* row = c->already_painted->words + y * c->already_painted->stride;
+        uint32_t* counts = tree + y / CANVAS_INDEX_BLOCK * w;
+        for (size_t word = 0; word < c->already_painted->stride; ++word) {
+            for (uint64_t bits = row[word]; bits; bits &= bits - 1)
+                counts[word * 64 + __builtin_ctzll(bits)]++;
+        }
+    }
+    for (size_t b = 0; b < blocks; ++b) {
+        for (size_t j = 1; j <= w; ++j) {
+            size_t parent = j + (j & -j);
+            if (parent <= w)
+                tree[b * w + parent - 1] += tree[b * w + j - 1];
+        }
+    }
+    for (size_t i = 1; i <= blocks; ++i) {
+        size_t parent = i + (i & -i);
+        if (parent > blocks)
+            continue;
+        for (size_t x = 0; x < w; ++x)
+            tree[(parent - 1) * w + x] += tree[(i - 1) * w + x];
+    }
+}
 
-       if (already_painted[(y + size) * w + x])
-           *wasted += 1;
+// Brings the tree up to date with `already_painted`.
+void canvas_index_flush(struct canvas_index* c) {
+    if (c->tree_stale) {
+        canvas_index_rebuild_tree(c);
+    } else {
+        for (size_t k = 0; k < c->pending_len; ++k) {
+            int32_t entry = c->pending[k];
+            size_t cell = (entry < 0 ? -entry : entry) - 1;
+            size_t x = cell % c->w, b = cell / c->w / CANVAS_INDEX_BLOCK;
+            if (b >= c->blocks)
+                continue;
+            for (size_t i = b + 1; i <= c->blocks; i += i & -i)
+                for (size_t j = x + 1; j <= c->w; j += j & -j)
+                    c->painted_tree[(i - 1) * c->w + j - 1] += entry < 0 ? -1 : 1;
+        }
+    }
+    c->pending_len = 0;
+    c->tree_stale = false;
+}
+
+// Painted cells in the first `blocks` blocks of rows with x below `x`, as of
+// the last flush.
+size_t canvas_index_painted_before(const struct canvas_index* c,
+                                   size_t x, size_t blocks) {
+    size_t sum = 0;
+    for (size_t i = blocks; i > 0; i -= i & -i)
+        for (size_t j = x; j > 0; j -= j & -j)
+            sum += c->painted_tree[(i - 1) * c->w + j - 1];
+    return sum;
+}
+
+// Painted cells in the `cw` x `ch` rectangle at (x, y). Only cells that
+// should be painted ever are, but those are the ones that count as wasted
+// anyway.
+size_t canvas_index_painted(struct canvas_index* c,
+                            size_t x, size_t y,
+                            size_t cw, size_t ch) {
+    assert(x + cw <= c->w);
+    assert(y + ch <= c->h);
+    if (!cw || !ch)
+        return 0;
 
-       size++;
+    size_t words = (x + cw - 1) / 64 - x / 64 + 1;
+    size_t first, last, above, below;
+    canvas_index_split_rows(c, y, ch, &first, &last, &above, &below);
+    if (words * ch <= CANVAS_INDEX_SCAN_WORDS || first == last)
+        return bitcanvas_count_and(c->already_painted, c->painting, x, y, cw, ch);
+
+    canvas_index_flush(c);
+    return bitcanvas_count_and(c->already_painted, c->painting, x, y, cw, above) +
+           bitcanvas_count_and(c->already_painted, c->painting, x, y + ch - below, cw, below) +
+           canvas_index_painted_before(c, x + cw, last) -
+           canvas_index_painted_before(c, x, last) -
+           canvas_index_painted_before(c, x + cw, first) +
+           canvas_index_painted_before(c, x, first);
+}
+
+void canvas_index_changed(struct canvas_index* c, size_t x, size_t y, bool painted) {
+    if (c->tree_stale || y / CANVAS_INDEX_BLOCK >= c->blocks)
+        return;
+    if (c->pending_len == c->pending_cap) {
+        c->tree_stale = true;
+        return;
     }
+    int32_t entry = (int32_t)(y * c->w + x) + 1;
+    c->pending[c->pending_len++] = painted ? entry : -entry;
+}
+
+void canvas_index_update(struct canvas_index* c, size_t x, size_t y, bool painted) {
+    if (bitcanvas_get(c->already_painted, x, y) == painted)
+        return;
+    bitcanvas_set(c->already_painted, x, y, painted);
+    canvas_index_changed(c, x, y, painted);
+}
+
+void canvas_index_paint(struct canvas_index* c, size_t x, size_t y) {
+    canvas_index_update(c, x, y, true);
+}
+
+void canvas_index_erase(struct canvas_index* c, size_t x, size_t y) {
+    canvas_index_update(c, x, y, false);
+}
+
+// Paints the `len` cells of row `y` from `x` on, a word at a time.
+void canvas_index_paint_row(struct canvas_index* c, size_t x, size_t y, size_t len) {
+    assert(len);
+    assert(x + len <= c->w);
+    size_t first = x / 64, last = (x + len - 1) / 64;
+    for (size_t word = first; word <= last; ++word) {
+        size_t from = word == first ? x % 64 : 0;
+        size_t to = word == last ? (x + len - 1) % 64 + 1 : 64;
+        uint64_t fresh = bitcanvas_fill_word(c->already_painted, word, y, word_mask(from, to));
+        while (fresh) {
+            canvas_index_changed(c, word * 64 + __builtin_ctzll(fresh), y, true);
+            fresh &= fresh - 1;
+        }
+    }
+}
+
+size_t line_to_right_len(struct canvas_index* c,
+                         size_t x, size_t y,
+                         size_t* wasted) {
+    assert(x < c->w);
+    assert(y < c->h);
+    assert(bitcanvas_get(c->painting, x, y));
+    assert(!bitcanvas_get(c->already_painted, x, y));
+
+    size_t size = bitcanvas_run_end(c->painting, y, x) - x;
+    *wasted = canvas_index_painted(c, x, y, size, 1);
+    return size;
+}
+
+size_t line_to_bottom_len(struct canvas_index* c,
+                          size_t x, size_t y,
+                          size_t* wasted) {
+    assert(x < c->w);
+    assert(y < c->h);
+    assert(bitcanvas_get(c->painting, x, y));
+    assert(!bitcanvas_get(c->already_painted, x, y));
 
+    size_t size = bitcanvas_run_end(&c->painting_transposed, x, y) - y;
+    *wasted = canvas_index_painted(c, x, y, 1, size);
     return size;
 }
 
-size_t square_half_side_len(uint8_t* grid,
-                            uint8_t* already_painted,
-                            size_t w, size_t h,
+// Finds the only cell that shouldn't be painted in the `dim` x `dim` square
+// at (x, y), by bisecting first the columns, then the rows of that column.
+void square_find_hole(const struct canvas_index* c,
+                      size_t x, size_t y, size_t dim,
+                      size_t* hole_x, size_t* hole_y) {
+    assert(canvas_index_to_paint(c, x, y, dim, dim) == dim * dim - 1);
+
+    size_t lo = 1, hi = dim;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (canvas_index_to_paint(c, x, y, mid, dim) < mid * dim)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    *hole_x = x + lo - 1;
+
+    lo = 1, hi = dim;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (canvas_index_to_paint(c, *hole_x, y, 1, mid) < mid)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    *hole_y = y + lo - 1;
+    assert(!bitcanvas_get(c->painting, *hole_x, *hole_y));
+}
+
+size_t square_half_side_len(struct canvas_index* c,
                             size_t x, size_t y,
                             size_t* wasted,
                             bool* have_to_delete,
                             size_t* to_delete_x,
                             size_t* to_delete_y) {
-    // TODO: This function could just use min(line_to_right, line_to_bottom)
-    // and check the inner part of the square then.
+    size_t w = c->w, h = c->h;
     assert(x < w);
     assert(y < h);
-    assert(grid[y * w + x]);
-    assert(!already_painted[y * w + x]);
+    assert(bitcanvas_get(c->painting, x, y));
+    assert(!bitcanvas_get(c->already_painted, x, y));
 
     *have_to_delete = false;
     size_t best_side = 0;
@@ -155,7 +666,6 @@ size_t square_half_side_len(uint8_t* grid,
     size_t side = 1;
     while (true) {
         size_t dim = 2 * side + 1;
-        size_t current_wasted = 0;
         bool have_to_delete_this_round = false;
         size_t to_delete_y_this_round, to_delete_x_this_round;
 
@@ -164,25 +674,26 @@ size_t square_half_side_len(uint8_t* grid,
         if (y + dim > h || x + dim > w)
             break;
 
-        for (size_t i = 0; i < dim; ++i) {
-            for (size_t j = 0; j < dim; ++j) {
-                if (!grid[(y + j) * w + x + i]) {
-                    if (*have_to_delete && x + i != *to_delete_x && y + j != *to_delete_y)
-                        goto end; // No more than 1 delete per square
-                    if (have_to_delete_this_round)
-                        goto end; // Same
-                    have_to_delete_this_round = true;
-                    to_delete_x_this_round = x + i;
-                    to_delete_y_this_round = y + j;
-                    current_wasted++;
-                    continue;
-                }
-
-                if (already_painted[(y + j) * w + x + i])
-                    current_wasted++;
-            }
+        // The cells that shouldn't be painted are wasted, and there can only
+        // be one, which gets deleted. If we're deleting for a smaller square
+        // already, it has to be on the same row or column.
+        size_t holes = dim * dim - canvas_index_to_paint(c, x, y, dim, dim);
+        if (holes > 1)
+            goto end; // No more than 1 delete per square
+        if (holes) {
+            size_t hole_x, hole_y;
+            square_find_hole(c, x, y, dim, &hole_x, &hole_y);
+            if (*have_to_delete && hole_x != *to_delete_x && hole_y != *to_delete_y)
+                goto end;
+            have_to_delete_this_round = true;
+            to_delete_x_this_round = hole_x;
+            to_delete_y_this_round = hole_y;
         }
 
+        // The ones painted already are wasted too. Holes never are, they're
+        // erased right after painting over them.
+        size_t current_wasted = holes + canvas_index_painted(c, x, y, dim, dim);
+
         // If we reached here, we've got a valid square that *might* be better
         // than the previous.
         size_t best_dim = 2 * best_side + 1;
@@ -215,139 +726,198 @@ end:
     return best_side;
 }
 
-void ensure_grid_eq(uint8_t* a, uint8_t* b, size_t w, size_t h) {
-    size_t total = w * h;
-
-    for (size_t i = 0; i < total; ++i)
-        assert(a[i] == b[i]);
+void ensure_grid_eq(const struct bitcanvas* a, const struct bitcanvas* b) {
+    assert(bitcanvas_eq(a, b));
+    (void)a;
+    (void)b;
 }
 
-int main(int argc, char** argv) {
-    assert(argc > 1);
-
-    FILE* f = fopen(argv[1], "r");
-    assert(f);
+// The order the greedy visits the cells to paint in. Every decision only
+// depends on what's painted by then, so any order paints the figure, with
+// different commands. COLUMNS is the order it was written for, and the
+// default.
+//
+//  - COLUMNS: column by column, top to bottom. Found on a transposed copy of
+//    the painting, so looking for the next cell to paint is a scan along a
+//    row of words there too. The index tables are still walked a row apart
+//    per cell, though.
+//  - ROWS: row by row, left to right, the way everything is laid out.
+//  - TILES: `tile` x `tile` squares, a row of them at a time, and row by row
+//    inside, so the neighbourhood the queries of a cell look at is mostly in
+//    cache already from the cells before.
+enum traversal_order {
+    TRAVERSE_COLUMNS,
+    TRAVERSE_ROWS,
+    TRAVERSE_TILES
+};
 
-    unsigned int width = 0, height = 0;
-    fscanf(f, "%u %u\n", &height, &width);
+const char* traversal_order_names[] = { "columns", "rows", "tiles" };
 
-    assert(width > 0 && width < 1000);
-    assert(height > 0 && height < 1000);
+struct traversal {
+    const struct bitcanvas* cells; // The painting, or its transpose
+    struct bitcanvas transposed;
+    bool transposed_cells;
+    size_t tile_w;
+    size_t tile_h;
+    size_t tile_x;                 // The tile we're in
+    size_t tile_y;
+    size_t x;                      // Where to look next in it
+    size_t y;
+};
 
-    fprintf(stderr, "w: %u, h: %u\n", width, height);
+void traversal_init(struct traversal* t,
+                    const struct bitcanvas* painting,
+                    enum traversal_order order,
+                    size_t tile) {
+    t->transposed_cells = order == TRAVERSE_COLUMNS;
+    if (t->transposed_cells) {
+        bitcanvas_transpose(painting, &t->transposed);
+        t->cells = &t->transposed;
+    } else {
+        t->cells = painting;
+    }
 
-    // + 1 => extra \0 added by fgets
-    uint8_t* painting = calloc(width * height + 1, 1);
-    uint8_t* grid = calloc(width * height, 1);
-    struct command_list list = COMMAND_LIST_INITIALIZER;
+    if (order == TRAVERSE_TILES) {
+        assert(tile);
+        t->tile_w = t->tile_h = tile;
+    } else {
+        t->tile_w = t->cells->w;
+        t->tile_h = t->cells->h;
+    }
+    t->tile_x = t->tile_y = t->x = t->y = 0;
+}
 
-    assert(painting);
-    assert(grid);
+void traversal_free(struct traversal* t) {
+    if (t->transposed_cells)
+        bitcanvas_free(&t->transposed);
+}
 
-    unsigned int to_read = height;
-    while (to_read--) {
-        unsigned int offset = (height - to_read - 1) * width;
-        size_t read = fread(painting + offset, 1, width, f);
-        assert(read == width);
-        (void)fgetc(f); // Discard newline
-    }
+// The next cell that should be painted, if any is left. Whether it's been
+// painted meanwhile is up to the caller.
+bool traversal_next(struct traversal* t, size_t* x, size_t* y) {
+    const struct bitcanvas* c = t->cells;
+    while (t->tile_y < c->h) {
+        size_t x_end = t->tile_x + t->tile_w < c->w ? t->tile_x + t->tile_w : c->w;
+        size_t y_end = t->tile_y + t->tile_h < c->h ? t->tile_y + t->tile_h : c->h;
+        for (; t->y < y_end; t->y++, t->x = t->tile_x) {
+            size_t found;
+            if (bitcanvas_next_set(c, t->y, t->x, x_end, &found)) {
+                t->x = found + 1;
+                *x = t->transposed_cells ? t->y : found;
+                *y = t->transposed_cells ? found : t->y;
+                return true;
+            }
+        }
 
-    size_t total = width * height;
-    for (size_t i = 0; i < total; ++i) {
-        switch (painting[i]) {
-            case '.':
-                painting[i] = 0;
-                break;
-            case '#':
-                painting[i] = 1;
-                break;
-            default:
-                assert(0 && "Unexpected character found");
+        t->tile_x += t->tile_w;
+        if (t->tile_x >= c->w) {
+            t->tile_x = 0;
+            t->tile_y += t->tile_h;
         }
+        t->x = t->tile_x;
+        t->y = t->tile_y;
     }
+    return false;
+}
 
-#define GRID(x, y) grid[((y) * width) + x]
-#define PAINTING(x, y) painting[((y) * width) + x]
+struct solve_options {
+    enum traversal_order order;
+    size_t tile;
+    bool trace;     // Print every decision to stderr, on a single thread
+    size_t threads; // Above 1, regions get painted in parallel
+};
 
-    for (size_t i = 0; i < width; ++i) {
-        for (size_t j = 0; j < height; ++j) {
-            if (!PAINTING(i, j) || GRID(i, j))
-                continue;
-            struct command command;
-            size_t r_wasted, b_wasted, square_wasted;
-            size_t to_delete_x, to_delete_y;
-            bool have_to_delete;
+// Paints `painting` greedily, one cell at a time, in the order of `options`,
+// adding the commands to `list`.
+void solve(const struct bitcanvas* painting,
+           const struct solve_options* options,
+           struct command_list* list) {
+    struct bitcanvas grid;
+    bitcanvas_init(&grid, painting->w, painting->h);
+
+    struct canvas_index index;
+    canvas_index_init(&index, painting, &grid);
+
+    struct traversal traversal;
+    traversal_init(&traversal, painting, options->order, options->tile);
+
+#define GRID(x, y) bitcanvas_get(&grid, x, y)
+#define PAINTING(x, y) bitcanvas_get(painting, x, y)
+
+    size_t i, j;
+    while (traversal_next(&traversal, &i, &j)) {
+        if (GRID(i, j))
+            continue;
+        struct command command;
+        size_t r_wasted, b_wasted, square_wasted;
+        size_t to_delete_x, to_delete_y;
+        bool have_to_delete;
 
-            size_t rlen = line_to_right_len(painting, grid, width, height, i, j, &r_wasted);
-            size_t blen = line_to_bottom_len(painting, grid, width, height, i, j, &b_wasted);
-            size_t square_half_side = square_half_side_len(painting, grid, width, height, i, j, &square_wasted, &have_to_delete, &to_delete_x, &to_delete_y);
-            size_t square_dim = 2 * square_half_side + 1;
-            size_t square_filled = square_dim * square_dim;
+        size_t rlen = line_to_right_len(&index, i, j, &r_wasted);
+        size_t blen = line_to_bottom_len(&index, i, j, &b_wasted);
+        size_t square_half_side = square_half_side_len(&index, i, j, &square_wasted, &have_to_delete, &to_delete_x, &to_delete_y);
+        size_t square_dim = 2 * square_half_side + 1;
+        size_t square_filled = square_dim * square_dim;
 
-            // Min line len is 1
-            assert(rlen);
-            assert(blen);
+        // Min line len is 1
+        assert(rlen);
+        assert(blen);
 
+        if (options->trace)
             fprintf(stderr, "(%zu, %zu): rline(%zu - %zu), bline(%zu - %zu), square(%zu - %zu, %s)\n", i, j,
                                                                                                    rlen, r_wasted,
                                                                                                    blen, b_wasted,
                                                                                                    square_filled, square_wasted,
                                                                                                    have_to_delete ? "true" : "false");
 
-            // There must always be a benefit
-            assert(rlen > r_wasted);
-            assert(blen > b_wasted);
-            assert(square_filled >= square_wasted);
-
-            // We just do the best we can do right now, we don't look ahead
-            if (rlen - r_wasted > blen - b_wasted &&
-                rlen - r_wasted > square_filled - square_wasted) {
-                command.type = PAINT_LINE;
-                command.data.line.x1 = i;
-                command.data.line.y1 = j;
-                command.data.line.x2 = i + rlen - 1;
-                command.data.line.y2 = j;
-                command_list_add(&list, &command);
-
-                while (rlen--) {
-                    assert(PAINTING(i + rlen, j));
-                    GRID(i + rlen, j) = 1;
-                }
-            } else if (blen - b_wasted > square_filled - square_wasted) {
-                command.type = PAINT_LINE;
-                command.data.line.x1 = i;
-                command.data.line.y1 = j;
-                command.data.line.x2 = i;
-                command.data.line.y2 = j + blen -1;
-                command_list_add(&list, &command);
-
-                while (blen--) {
-                    assert(PAINTING(i, j + blen));
-                    GRID(i, j + blen) = 1;
-                }
-            } else {
-                command.type = PAINT_SQUARE;
-                command.data.square.s = square_half_side;
-                command.data.square.x = i + square_half_side;
-                command.data.square.y = j + square_half_side;
-                command_list_add(&list, &command);
-
-                size_t dim = 2 * square_half_side + 1;
-                for (size_t ii = 0; ii < dim; ++ii) {
-                    for (size_t jj = 0; jj < dim; ++jj) {
-                        assert(PAINTING(i + ii, j + jj) ||
-                               (have_to_delete && i + ii == to_delete_x && j + jj == to_delete_y));
-                        GRID(i + ii, j + jj) = 1;
-                    }
-                }
+        // There must always be a benefit
+        assert(rlen > r_wasted);
+        assert(blen > b_wasted);
+        assert(square_filled >= square_wasted);
 
-                if (have_to_delete) {
-                    command.type = ERASE;
-                    command.data.erase.x = to_delete_x;
-                    command.data.erase.y = to_delete_y;
-                    command_list_add(&list, &command);
-                    GRID(to_delete_x, to_delete_y) = 0;
-                }
+        // We just do the best we can do right now, we don't look ahead
+        if (rlen - r_wasted > blen - b_wasted &&
+            rlen - r_wasted > square_filled - square_wasted) {
+            command.type = PAINT_LINE;
+            command.data.line.x1 = i;
+            command.data.line.y1 = j;
+            command.data.line.x2 = i + rlen - 1;
+            command.data.line.y2 = j;
+            command_list_add(list, &command);
+
+            assert(canvas_index_to_paint(&index, i, j, rlen, 1) == rlen);
+            canvas_index_paint_row(&index, i, j, rlen);
+        } else if (blen - b_wasted > square_filled - square_wasted) {
+            command.type = PAINT_LINE;
+            command.data.line.x1 = i;
+            command.data.line.y1 = j;
+            command.data.line.x2 = i;
+            command.data.line.y2 = j + blen -1;
+            command_list_add(list, &command);
+
+            while (blen--) {
+                assert(PAINTING(i, j + blen));
+                canvas_index_paint(&index, i, j + blen);
+            }
+        } else {
+            command.type = PAINT_SQUARE;
+            command.data.square.s = square_half_side;
+            command.data.square.x = i + square_half_side;
+            command.data.square.y = j + square_half_side;
+            command_list_add(list, &command);
+
+            size_t dim = 2 * square_half_side + 1;
+            assert(canvas_index_to_paint(&index, i, j, dim, dim) == dim * dim - have_to_delete);
+            assert(!have_to_delete || !PAINTING(to_delete_x, to_delete_y));
+            for (size_t jj = 0; jj < dim; ++jj)
+                canvas_index_paint_row(&index, i, j + jj, dim);
+
+            if (have_to_delete) {
+                command.type = ERASE;
+                command.data.erase.x = to_delete_x;
+                command.data.erase.y = to_delete_y;
+                command_list_add(list, &command);
+                canvas_index_erase(&index, to_delete_x, to_delete_y);
             }
         }
     }
@@ -355,47 +925,643 @@ int main(int argc, char** argv) {
 #undef GRID
 #undef PAINTING
 
-    ensure_grid_eq(painting, grid, width, height);
+    ensure_grid_eq(painting, &grid);
+
+    traversal_free(&traversal);
+    canvas_index_free(&index);
+    bitcanvas_free(&grid);
+}
+
+// A 4-connected set of cells to paint, with its bounding box (exclusive on
+// the end) and the runs of it on each row.
+//
+// No command of the greedy covers cells of two regions: a line only covers
+// cells to paint in a row, and a square with at most one hole in it is still
+// connected once the hole is taken out. The cells it counts as wasted are
+// under those commands too, so a region gets painted the same way on its
+// own as along with the rest of the canvas.
+struct region {
+    uint32_t x0;
+    uint32_t y0;
+    uint32_t x1;
+    uint32_t y1;
+    uint32_t cells;
+    uint32_t first_run;
+    uint32_t run_count;
+};
+
+struct run {
+    uint32_t y;
+    uint32_t x0;
+    uint32_t x1;
+};
+
+struct region_map {
+    struct region* regions;
+    size_t count;
+    struct run* runs; // By region, then row by row
+    size_t run_count;
+};
+
+uint32_t union_find_root(uint32_t* parents, uint32_t i) {
+    while (parents[i] != i) {
+        parents[i] = parents[parents[i]];
+        i = parents[i];
+    }
+    return i;
+}
+
+// Labels the regions of `painting`, joining the runs of cells to paint that
+// touch the ones of the row above.
+void region_map_init(struct region_map* m, const struct bitcanvas* painting) {
+    size_t w = painting->w, h = painting->h;
+    size_t cap = 1024, count = 0;
+    struct run* runs = malloc(cap * sizeof(struct run));
+    size_t* row_starts = malloc((h + 1) * sizeof(size_t));
+    assert(runs && row_starts);
+
+    for (size_t y = 0; y < h; ++y) {
+        row_starts[y] = count;
+        size_t x = 0;
+        while (bitcanvas_next_set(painting, y, x, w, &x)) {
+            size_t end = bitcanvas_run_end(painting, y, x);
+            if (count == cap) {
+                cap *= 2;
+                runs = realloc(runs, cap * sizeof(struct run));
+                assert(runs);
+            }
+            struct run run = { y, x, end };
+            runs[count++] = run;
+            x = end;
+        }
+    }
+    row_starts[h] = count;
+
+    uint32_t* parents = malloc(count * sizeof(uint32_t));
+    assert(parents || !count);
+    for (size_t i = 0; i < count; ++i)
+        parents[i] = i;
+
+    for (size_t y = 1; y < h; ++y) {
+        size_t above = row_starts[y - 1], here = row_starts[y];
+        while (above < row_starts[y] && here < row_starts[y + 1]) {
+            const struct run* a = &runs[above];
+            const struct run* b = &runs[here];
+            if (a->x0 < b->x1 && b->x0 < a->x1) {
+                uint32_t ra = union_find_root(parents, above);
+                uint32_t rb = union_find_root(parents, here);
+                if (ra < rb)
+                    parents[rb] = ra;
+                else
+                    parents[ra] = rb;
+            }
+            if (a->x1 < b->x1)
+                above++;
+            else
+                here++;
+        }
+    }
+    free(row_starts);
+
+    // Roots are the first run of their region, so once every run points to
+    // its root, the parents can become region ids in a single pass, in the
+    // order the regions first show up.
+    for (size_t i = 0; i < count; ++i)
+        parents[i] = union_find_root(parents, i);
+    size_t regions = 0;
+    for (size_t i = 0; i < count; ++i) {
+        assert(parents[i] <= i);
+        parents[i] = parents[i] == i ? regions++ : parents[parents[i]];
+    }
+
+    m->count = regions;
+    m->regions = calloc(regions ? regions : 1, sizeof(struct region));
+    assert(m->regions);
+    for (size_t i = 0; i < regions; ++i) {
+        m->regions[i].x0 = w;
+        m->regions[i].y0 = h;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        struct region* r = &m->regions[parents[i]];
+        const struct run* run = &runs[i];
+        if (run->x0 < r->x0)
+            r->x0 = run->x0;
+        if (run->y < r->y0)
+            r->y0 = run->y;
+        if (run->x1 > r->x1)
+            r->x1 = run->x1;
+        if (run->y + 1u > r->y1)
+            r->y1 = run->y + 1;
+        r->cells += run->x1 - run->x0;
+        r->run_count++;
+    }
+
+    m->run_count = count;
+    m->runs = malloc((count ? count : 1) * sizeof(struct run));
+    assert(m->runs);
+    size_t next = 0;
+    for (size_t i = 0; i < regions; ++i) {
+        m->regions[i].first_run = next;
+        next += m->regions[i].run_count;
+        m->regions[i].run_count = 0;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        struct region* r = &m->regions[parents[i]];
+        m->runs[r->first_run + r->run_count++] = runs[i];
+    }
+
+    free(parents);
+    free(runs);
+}
+
+void region_map_free(struct region_map* m) {
+    free(m->regions);
+    free(m->runs);
+}
 
-    printf("%zu\n", list.len);
-    struct command* current = list.head;
-    while (current) {
+// Where the greedy gets to (x, y) in the given order on a `w` x `h` canvas.
+uint64_t traversal_rank(enum traversal_order order, size_t tile,
+                        size_t w, size_t h, size_t x, size_t y) {
+    switch (order) {
+        case TRAVERSE_COLUMNS:
+            return (uint64_t)x * h + y;
+        case TRAVERSE_ROWS:
+            return (uint64_t)y * w + x;
+        case TRAVERSE_TILES: {
+            uint64_t tiles_per_row = (w + tile - 1) / tile;
+            uint64_t tile_index = (y / tile) * tiles_per_row + x / tile;
+            return tile_index * tile * tile + (y % tile) * tile + x % tile;
+        }
+    }
+    assert(0 && "Invalid order");
+    return 0;
+}
+
+// The cell the greedy was at when it gave `c`. Erases don't have one, they
+// come right after their square.
+bool command_origin(const struct command* c, size_t* x, size_t* y) {
+    switch (c->type) {
+        case PAINT_LINE:
+            *x = c->data.line.x1;
+            *y = c->data.line.y1;
+            return true;
+        case PAINT_SQUARE:
+            *x = c->data.square.x - c->data.square.s;
+            *y = c->data.square.y - c->data.square.s;
+            return true;
+        case ERASE:
+            return false;
+    }
+    return false;
+}
+
+void command_translate(struct command* c, size_t dx, size_t dy) {
+    switch (c->type) {
+        case PAINT_LINE:
+            c->data.line.x1 += dx;
+            c->data.line.x2 += dx;
+            c->data.line.y1 += dy;
+            c->data.line.y2 += dy;
+            break;
+        case PAINT_SQUARE:
+            c->data.square.x += dx;
+            c->data.square.y += dy;
+            break;
+        case ERASE:
+            c->data.erase.x += dx;
+            c->data.erase.y += dy;
+            break;
+    }
+}
+
+// A group of regions next to each other in the order of the traversal,
+// painted on a canvas of their own, the size of their bounding box.
+struct region_job {
+    size_t first; // In `order` of the context
+    size_t last;
+    size_t x0;
+    size_t y0;
+    size_t x1;
+    size_t y1;
+    struct command_list commands;
+};
+
+struct region_context {
+    const struct region_map* map;
+    const uint32_t* order; // Region ids, sorted by where they start
+    const struct solve_options* options;
+    struct region_job* jobs;
+    size_t job_count;
+    size_t next_job;
+    pthread_mutex_t lock;
+};
+
+void region_job_solve(const struct region_context* ctx, struct region_job* job) {
+    struct bitcanvas canvas;
+    bitcanvas_init(&canvas, job->x1 - job->x0, job->y1 - job->y0);
+    for (size_t i = job->first; i < job->last; ++i) {
+        const struct region* r = &ctx->map->regions[ctx->order[i]];
+        for (size_t k = 0; k < r->run_count; ++k) {
+            const struct run* run = &ctx->map->runs[r->first_run + k];
+            bitcanvas_fill_row(&canvas, run->x0 - job->x0, run->y - job->y0, run->x1 - run->x0);
+        }
+    }
+
+    struct solve_options options = *ctx->options;
+    options.trace = false;
+    solve(&canvas, &options, &job->commands);
+    for (size_t i = 0; i < job->commands.len; ++i)
+        command_translate(&job->commands.commands[i], job->x0, job->y0);
+    bitcanvas_free(&canvas);
+}
+
+void* region_worker(void* arg) {
+    struct region_context* ctx = arg;
+    while (true) {
+        pthread_mutex_lock(&ctx->lock);
+        size_t i = ctx->next_job++;
+        pthread_mutex_unlock(&ctx->lock);
+        if (i >= ctx->job_count)
+            break;
+        region_job_solve(ctx, &ctx->jobs[i]);
+    }
+    return NULL;
+}
+
+// Paints `painting` a region at a time, on `options->threads` threads.
+//
+// The regions are grouped into a few jobs per thread, of about the same
+// number of cells, each with regions next to each other along the scan, so
+// their bounding box stays small. Every job is painted on its own canvas,
+// in the same order the whole canvas would have been, and the commands are
+// merged back by where the greedy would have been when giving them, so the
+// result is the same as painting on a single thread, whatever finishes
+// first. A job's canvas starts on a tile boundary, so tiles line up.
+void solve_regions(const struct bitcanvas* painting,
+                   const struct solve_options* options,
+                   struct command_list* list) {
+    size_t w = painting->w, h = painting->h;
+    struct region_map map;
+    region_map_init(&map, painting);
+
+    // Regions are numbered in the order they start on a row by row scan,
+    // which is what jobs are cut along for rows and tiles. For columns, they
+    // get sorted by their first column.
+    uint32_t* order = malloc((map.count ? map.count : 1) * sizeof(uint32_t));
+    assert(order);
+    size_t total_cells = 0;
+    for (size_t i = 0; i < map.count; ++i) {
+        order[i] = i;
+        total_cells += map.regions[i].cells;
+    }
+    if (options->order == TRAVERSE_COLUMNS) {
+        size_t* column_starts = calloc(w + 1, sizeof(size_t));
+        assert(column_starts);
+        for (size_t i = 0; i < map.count; ++i)
+            column_starts[map.regions[i].x0 + 1]++;
+        for (size_t x = 0; x < w; ++x)
+            column_starts[x + 1] += column_starts[x];
+        for (size_t i = 0; i < map.count; ++i)
+            order[column_starts[map.regions[i].x0]++] = i;
+        free(column_starts);
+    }
+
+    size_t wanted = options->threads * 4;
+    size_t cells_per_job = (total_cells + wanted - 1) / wanted;
+    struct region_job* jobs = calloc(wanted + 1, sizeof(struct region_job));
+    assert(jobs);
+    size_t job_count = 0;
+    for (size_t i = 0; i < map.count;) {
+        struct region_job* job = &jobs[job_count++];
+        assert(job_count <= wanted + 1);
+        job->first = i;
+        job->x0 = w;
+        job->y0 = h;
+        size_t cells = 0;
+        while (i < map.count && (cells < cells_per_job || job_count == wanted + 1)) {
+            const struct region* r = &map.regions[order[i++]];
+            cells += r->cells;
+            job->x0 = r->x0 < job->x0 ? r->x0 : job->x0;
+            job->y0 = r->y0 < job->y0 ? r->y0 : job->y0;
+            job->x1 = r->x1 > job->x1 ? r->x1 : job->x1;
+            job->y1 = r->y1 > job->y1 ? r->y1 : job->y1;
+        }
+        job->last = i;
+        if (options->order == TRAVERSE_TILES) {
+            job->x0 -= job->x0 % options->tile;
+            job->y0 -= job->y0 % options->tile;
+        }
+    }
+
+    struct region_context ctx;
+    ctx.map = &map;
+    ctx.order = order;
+    ctx.options = options;
+    ctx.jobs = jobs;
+    ctx.job_count = job_count;
+    ctx.next_job = 0;
+    pthread_mutex_init(&ctx.lock, NULL);
+
+    size_t threads = options->threads < job_count ? options->threads : job_count;
+    pthread_t* workers = malloc((threads ? threads : 1) * sizeof(pthread_t));
+    assert(workers);
+    for (size_t i = 0; i < threads; ++i) {
+        int error = pthread_create(&workers[i], NULL, region_worker, &ctx);
+        assert(!error);
+        (void)error;
+    }
+    for (size_t i = 0; i < threads; ++i)
+        pthread_join(workers[i], NULL);
+    free(workers);
+    pthread_mutex_destroy(&ctx.lock);
+
+    // Merge: always take from the job whose next command the greedy would
+    // have got to first. An erase goes right after its square, which has
+    // the same rank.
+    size_t* next = calloc(job_count ? job_count : 1, sizeof(size_t));
+    uint64_t* ranks = malloc((job_count ? job_count : 1) * sizeof(uint64_t));
+    assert(next && ranks);
+    for (size_t j = 0; j < job_count; ++j) {
+        size_t x, y;
+        if (jobs[j].commands.len && command_origin(&jobs[j].commands.commands[0], &x, &y))
+            ranks[j] = traversal_rank(options->order, options->tile, w, h, x, y);
+    }
+    while (true) {
+        size_t best = job_count;
+        for (size_t j = 0; j < job_count; ++j) {
+            if (next[j] < jobs[j].commands.len && (best == job_count || ranks[j] < ranks[best]))
+                best = j;
+        }
+        if (best == job_count)
+            break;
+
+        const struct command_list* from = &jobs[best].commands;
+        command_list_add(list, &from->commands[next[best]++]);
+        size_t x, y;
+        if (next[best] < from->len && command_origin(&from->commands[next[best]], &x, &y))
+            ranks[best] = traversal_rank(options->order, options->tile, w, h, x, y);
+    }
+    free(next);
+    free(ranks);
+
+    for (size_t j = 0; j < job_count; ++j)
+        command_list_free(&jobs[j].commands);
+    free(jobs);
+    free(order);
+    region_map_free(&map);
+}
+
+// Paints `painting` on as many threads as the options say.
+void paint(const struct bitcanvas* painting,
+           const struct solve_options* options,
+           struct command_list* list) {
+    if (options->threads > 1)
+        solve_regions(painting, options, list);
+    else
+        solve(painting, options, list);
+}
+
+// Prints the submission for `list`, formatted into a single buffer and
+// written at once.
+bool write_commands(const struct command_list* list,
+                    size_t width, size_t height,
+                    FILE* out) {
+    char* buffer = malloc((list->len + 1) * MAX_FORMATTED_COMMAND);
+    assert(buffer);
+
+    char* end = format_uint(buffer, list->len);
+    *end++ = '\n';
+    for (size_t i = 0; i < list->len; ++i) {
+        const struct command* current = &list->commands[i];
         switch (current->type) {
             case PAINT_LINE:
                 assert(current->data.line.x1 < width);
                 assert(current->data.line.x2 < width);
                 assert(current->data.line.y1 < height);
                 assert(current->data.line.y2 < height);
-                // printf("PAINT_LINE %zu %zu %zu %zu\n", current->x1, current->y1, current->x2, current->y2);
                 // row, col, row, col
-                printf("PAINT_LINE %zu %zu %zu %zu\n", current->data.line.y1,
-                                                       current->data.line.x1,
-                                                       current->data.line.y2,
-                                                       current->data.line.x2);
+                end = format_string(end, "PAINT_LINE ");
+                end = format_uint(end, current->data.line.y1);
+                *end++ = ' ';
+                end = format_uint(end, current->data.line.x1);
+                *end++ = ' ';
+                end = format_uint(end, current->data.line.y2);
+                *end++ = ' ';
+                end = format_uint(end, current->data.line.x2);
                 break;
             case PAINT_SQUARE:
                 assert(current->data.square.x >= current->data.square.s);
                 assert(current->data.square.y >= current->data.square.s);
                 assert(current->data.square.x + current->data.square.s < width);
                 assert(current->data.square.y + current->data.square.s < height);
-                printf("PAINT_SQUARE %zu %zu %zu\n", current->data.square.y,
-                                                     current->data.square.x,
-                                                     current->data.square.s);
+                end = format_string(end, "PAINT_SQUARE ");
+                end = format_uint(end, current->data.square.y);
+                *end++ = ' ';
+                end = format_uint(end, current->data.square.x);
+                *end++ = ' ';
+                end = format_uint(end, current->data.square.s);
                 break;
             case ERASE:
                 assert(current->data.erase.x < width);
                 assert(current->data.erase.y < height);
-                printf("ERASE_CELL %zu %zu\n", current->data.erase.y, current->data.erase.x);
+                end = format_string(end, "ERASE_CELL ");
+                end = format_uint(end, current->data.erase.y);
+                *end++ = ' ';
+                end = format_uint(end, current->data.erase.x);
                 break;
             default:
                 assert(0 && "Invalid type");
         }
-        current = current->next;
+        *end++ = '\n';
+    }
+
+    size_t len = end - buffer;
+    bool written = fwrite(buffer, 1, len, out) == len && fflush(out) == 0;
+    free(buffer);
+    return written;
+}
+
+// Counts the hardware cache misses of the calling thread, and of the ones it
+// starts meanwhile, where the kernel lets us. `fd` is -1 where it doesn't.
+struct cache_counter {
+    int fd;
+};
+
+void cache_counter_start(struct cache_counter* c) {
+    c->fd = -1;
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = 1;
+    c->fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (c->fd < 0) {
+        c->fd = -1;
+        return;
     }
+    ioctl(c->fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(c->fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+}
+
+// The misses since cache_counter_start(), if they could be counted.
+bool cache_counter_stop(struct cache_counter* c, uint64_t* misses) {
+#ifdef __linux__
+    if (c->fd < 0)
+        return false;
+    ioctl(c->fd, PERF_EVENT_IOC_DISABLE, 0);
+    bool counted = read(c->fd, misses, sizeof(*misses)) == sizeof(*misses);
+    close(c->fd);
+    return counted;
+#else
+    (void)c;
+    (void)misses;
+    return false;
+#endif
+}
+
+double milliseconds_since(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Paints the painting in every order, and prints how long each took, with
+// how many cache misses, instead of the commands.
+void bench(const struct bitcanvas* painting, size_t tile, size_t threads) {
+    printf("%-8s %10s %14s %10s\n", "order", "ms", "cache_misses", "commands");
+    for (int order = TRAVERSE_COLUMNS; order <= TRAVERSE_TILES; ++order) {
+        struct solve_options options = { order, tile, false, threads };
+        struct command_list list = COMMAND_LIST_INITIALIZER;
+        struct cache_counter counter;
+        struct timespec start;
+        uint64_t misses;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        cache_counter_start(&counter);
+        paint(painting, &options, &list);
+        bool counted = cache_counter_stop(&counter, &misses);
+        double ms = milliseconds_since(&start);
+
+        printf("%-8s %10.1f ", traversal_order_names[order], ms);
+        if (counted)
+            printf("%14llu", (unsigned long long)misses);
+        else
+            printf("%14s", "-");
+        printf(" %10zu\n", list.len);
+        command_list_free(&list);
+    }
+}
+
+void usage(const char* program) {
+    fprintf(stderr, "usage: %s [--order columns|rows|tiles] [--tile N] [--threads N] [--quiet] <input>\n"
+                    "       %s --bench [--tile N] [--threads N] <input>\n", program, program);
+}
+
+int main(int argc, char** argv) {
+    struct solve_options options = { TRAVERSE_COLUMNS, 64, true, 1 };
+    bool benchmark = false;
+    const char* input = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--order") && i + 1 < argc) {
+            const char* name = argv[++i];
+            int order = TRAVERSE_COLUMNS;
+            while (order <= TRAVERSE_TILES && strcmp(name, traversal_order_names[order]))
+                order++;
+            if (order > TRAVERSE_TILES) {
+                usage(argv[0]);
+                return 1;
+            }
+            options.order = order;
+        } else if (!strcmp(argv[i], "--tile") && i + 1 < argc) {
+            options.tile = strtoul(argv[++i], NULL, 10);
+            if (!options.tile) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            options.threads = strtoul(argv[++i], NULL, 10);
+            if (!options.threads) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--quiet")) {
+            options.trace = false;
+        } else if (!strcmp(argv[i], "--bench")) {
+            benchmark = true;
+        } else if (!input && argv[i][0] != '-') {
+            input = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!input) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE* f = fopen(input, "r");
+    assert(f);
+
+    unsigned int width = 0, height = 0;
+    fscanf(f, "%u %u\n", &height, &width);
+
+    // Cells are numbered with 31 bits in the canvas index.
+    assert(width > 0 && height > 0);
+    assert((size_t)width * height < INT32_MAX);
+
+    fprintf(stderr, "w: %u, h: %u\n", width, height);
+
+    bitcanvas_select_kernels();
+
+    struct bitcanvas painting;
+    bitcanvas_init(&painting, width, height);
+    struct command_list list = COMMAND_LIST_INITIALIZER;
+
+    char* row = malloc(width);
+    assert(row);
+
+    for (unsigned int y = 0; y < height; ++y) {
+        size_t read = fread(row, 1, width, f);
+        assert(read == width);
+        (void)read;
+        (void)fgetc(f); // Discard newline
+
+        for (unsigned int x = 0; x < width; ++x) {
+            switch (row[x]) {
+                case '.':
+                    break;
+                case '#':
+                    bitcanvas_set(&painting, x, y, true);
+                    break;
+                default:
+                    assert(0 && "Unexpected character found");
+            }
+        }
+    }
+    free(row);
+    fclose(f);
+
+    if (benchmark) {
+        bench(&painting, options.tile, options.threads);
+        bitcanvas_free(&painting);
+        return 0;
+    }
+
+    paint(&painting, &options, &list);
+
+    bool written = write_commands(&list, width, height, stdout);
+    assert(written);
+    (void)written;
 
     command_list_free(&list);
-    free(painting);
-    free(grid);
+    bitcanvas_free(&painting);
 
     return 0;
 }
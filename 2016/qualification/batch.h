@@ -0,0 +1,167 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/stat.h>
+
+#include "commands.h"
+#include "simulation.h"
+#include "scorer.h"
+#include "planner.h"
+#include "parallel.h"
+
+// Solves several inputs in one process, what doit.sh does one process after
+// another: the default strategy on each, written to <output dir>/<input
+// name>.out with its header, and scored.
+//
+// Every thread solves one input at a time, so at most as many are in memory
+// at once as there are threads, each with a copy to score the plan against.
+// The largest inputs go first, so the slowest isn't left for the end, and
+// with enough threads the whole batch takes about as long as it does.
+class BatchRunner {
+public:
+    struct Result {
+        std::string output;
+        double parse_ms;
+        double plan_ms;
+        double emit_ms;
+        double total_ms;
+        size_t commands;
+        size_t score;
+        bool ok;
+        std::string error;
+
+        Result()
+            : parse_ms(0), plan_ms(0), emit_ms(0), total_ms(0)
+            , commands(0), score(0), ok(false) {}
+    };
+
+private:
+    std::string m_output_dir;
+    ThreadPool m_pool;
+
+    static double milliseconds_since(std::chrono::steady_clock::time_point start) {
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    std::string output_for(const std::string& input) const {
+        size_t slash = input.rfind('/');
+        std::string name = slash == std::string::npos ? input : input.substr(slash + 1);
+        return m_output_dir + "/" + name + ".out";
+    }
+
+    Result solve(const std::string& input) const {
+        Result result;
+        result.output = output_for(input);
+        try {
+            auto start = std::chrono::steady_clock::now();
+            const Simulation initial(input.c_str());
+            result.parse_ms = milliseconds_since(start);
+
+            auto planning = std::chrono::steady_clock::now();
+            Simulation simulation(initial);
+            Plan plan(simulation.m_drones.size());
+            Planner planner(simulation, Strategy(), plan);
+            planner.run();
+            plan.optimize();
+            result.plan_ms = milliseconds_since(planning);
+
+            auto emitting = std::chrono::steady_clock::now();
+            if (!plan.write_to(result.output.c_str())) {
+                result.error = result.output + ": " + strerror(errno);
+                return result;
+            }
+            result.emit_ms = milliseconds_since(emitting);
+            result.total_ms = milliseconds_since(start);
+
+            ScoreReport report = Scorer(initial).score(plan);
+            result.commands = plan.count();
+            result.score = report.score;
+            result.ok = report.valid;
+            if (!report.valid)
+                result.error = report.error;
+        } catch (const ParseError& error) {
+            result.error = error.what();
+        }
+        return result;
+    }
+
+public:
+    BatchRunner(const std::string& output_dir, size_t threads)
+        : m_output_dir(output_dir)
+        , m_pool(threads) {}
+
+    // Solves the inputs and prints a row per input, in the order they were
+    // given. Returns false if any failed, or produced an invalid plan.
+    bool run(const std::vector<std::string>& inputs, std::ostream& out) {
+        if (mkdir(m_output_dir.c_str(), 0777) < 0 && errno != EEXIST) {
+            std::cerr << m_output_dir << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+
+        std::vector<size_t> order(inputs.size());
+        std::vector<size_t> sizes(inputs.size(), 0);
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            order[i] = i;
+            struct stat info;
+            if (stat(inputs[i].c_str(), &info) == 0)
+                sizes[i] = info.st_size;
+        }
+        std::stable_sort(order.begin(), order.end(), [&sizes](size_t a, size_t b) {
+            return sizes[a] > sizes[b];
+        });
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<Result> results(inputs.size());
+        m_pool.parallel_for(order.size(), [&](size_t i) {
+            results[order[i]] = solve(inputs[order[i]]);
+        });
+        double wall_ms = milliseconds_since(start);
+
+        size_t width = 5;
+        for (auto& input: inputs)
+            width = std::max(width, input.size());
+
+        bool ok = true;
+        size_t total_score = 0;
+        double slowest_ms = 0;
+        out << std::left << std::setw(width) << "input" << std::right
+            << std::setw(10) << "parse_ms" << std::setw(10) << "plan_ms"
+            << std::setw(10) << "emit_ms" << std::setw(10) << "total_ms"
+            << std::setw(10) << "commands" << std::setw(10) << "score" << std::endl;
+        out << std::fixed << std::setprecision(1);
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            const Result& result = results[i];
+            out << std::left << std::setw(width) << inputs[i] << std::right;
+            if (!result.ok) {
+                out << "  failed: " << result.error << std::endl;
+                ok = false;
+                continue;
+            }
+            out << std::setw(10) << result.parse_ms << std::setw(10) << result.plan_ms
+                << std::setw(10) << result.emit_ms << std::setw(10) << result.total_ms
+                << std::setw(10) << result.commands << std::setw(10) << result.score << std::endl;
+            total_score += result.score;
+            slowest_ms = std::max(slowest_ms, result.total_ms);
+        }
+        size_t threads = std::min(m_pool.size(), inputs.size());
+        out << inputs.size() << " inputs on " << threads << (threads == 1 ? " thread" : " threads")
+            << " in " << wall_ms << " ms (slowest " << slowest_ms
+            << " ms), score " << total_score << std::endl;
+        out.unsetf(std::ios::floatfield);
+        out << std::setprecision(6);
+        return ok;
+    }
+};
+
+#endif
@@ -0,0 +1,383 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "commands.h"
+#include "simulation.h"
+#include "scorer.h"
+#include "planner.h"
+#include "generator.h"
+
+// Times the default solver on a set of inputs, phase by phase:
+//
+//  - parse: loading the input into a Simulation.
+//  - plan: running the default strategy and merging the commands.
+//  - emit: serializing and writing the plan, to /dev/null so the disk stays
+//    out of it.
+//
+// Every input runs in its own child process, so the peak RSS we get back from
+// wait4 is that input's, not the largest one so far.
+class Benchmark {
+public:
+    enum Format {
+        CSV,
+        JSON,
+    };
+
+    struct Summary {
+        double median;
+        double p95;
+    };
+
+    // What a child sends back through its pipe. Plain data, so a single write
+    // does it.
+    struct Result {
+        Summary parse, plan, emit, total;
+        size_t runs;
+        size_t bytes;
+        size_t score;
+        size_t commands;
+        bool valid;
+    };
+
+    enum Status {
+        OK,
+        FAILED,
+        TIMED_OUT,
+    };
+
+private:
+    size_t m_runs;
+    Format m_format;
+    unsigned m_timeout;
+
+    static double milliseconds_since(std::chrono::steady_clock::time_point start) {
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    // Nearest rank percentiles, so they're always an actual sample.
+    static Summary summarize(std::vector<double> times) {
+        std::sort(times.begin(), times.end());
+        size_t p95 = static_cast<size_t>(std::ceil(times.size() * 0.95)) - 1;
+        Summary summary = { times[times.size() / 2], times[p95] };
+        return summary;
+    }
+
+    Result measure_runs(const char* input) const {
+        Result result;
+        std::memset(&result, 0, sizeof(result));
+        result.runs = m_runs;
+        result.bytes = InputParser(input).size();
+
+        std::vector<double> parse, plan, emit, total;
+        Plan last;
+        for (size_t i = 0; i < m_runs; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            Simulation simulation(input);
+            parse.push_back(milliseconds_since(start));
+
+            auto planning = std::chrono::steady_clock::now();
+            Plan out(simulation.m_drones.size());
+            Planner planner(simulation, Strategy(), out);
+            planner.run();
+            out.optimize();
+            plan.push_back(milliseconds_since(planning));
+
+            auto emitting = std::chrono::steady_clock::now();
+            if (!out.write_to("/dev/null"))
+                return result;
+            emit.push_back(milliseconds_since(emitting));
+            total.push_back(milliseconds_since(start));
+
+            last = std::move(out);
+        }
+
+        result.parse = summarize(parse);
+        result.plan = summarize(plan);
+        result.emit = summarize(emit);
+        result.total = summarize(total);
+
+        // Not timed, but a faster solver that scores worse isn't faster.
+        const Simulation simulation(input);
+        ScoreReport report = Scorer(simulation).score(last);
+        result.score = report.score;
+        result.commands = last.count();
+        result.valid = report.valid;
+        return result;
+    }
+
+    void print_header(std::ostream& out) const {
+        if (m_format == JSON) {
+            out << "[";
+            return;
+        }
+        out << "input,runs,bytes,"
+            << "parse_median_ms,parse_p95_ms,"
+            << "plan_median_ms,plan_p95_ms,"
+            << "emit_median_ms,emit_p95_ms,"
+            << "total_median_ms,total_p95_ms,"
+            << "peak_rss_kb,score,commands" << std::endl;
+    }
+
+    void print_row(std::ostream& out, const char* input, const Result& result,
+                   long peak_rss_kb, bool first) const {
+        if (m_format == CSV) {
+            out << input << ',' << result.runs << ',' << result.bytes << ','
+                << result.parse.median << ',' << result.parse.p95 << ','
+                << result.plan.median << ',' << result.plan.p95 << ','
+                << result.emit.median << ',' << result.emit.p95 << ','
+                << result.total.median << ',' << result.total.p95 << ','
+                << peak_rss_kb << ',' << result.score << ',' << result.commands << std::endl;
+            return;
+        }
+
+        auto phase = [&](const char* name, const Summary& summary) {
+            out << ", \"" << name << "_ms\": {\"median\": " << summary.median
+                << ", \"p95\": " << summary.p95 << "}";
+        };
+
+        // Input paths come from the command line, and nobody names their
+        // inputs with quotes or backslashes.
+        out << (first ? "\n" : ",\n")
+            << "  {\"input\": \"" << input << "\", \"runs\": " << result.runs
+            << ", \"bytes\": " << result.bytes;
+        phase("parse", result.parse);
+        phase("plan", result.plan);
+        phase("emit", result.emit);
+        phase("total", result.total);
+        out << ", \"peak_rss_kb\": " << peak_rss_kb
+            << ", \"score\": " << result.score
+            << ", \"commands\": " << result.commands << "}";
+    }
+
+    void print_footer(std::ostream& out) const {
+        if (m_format == JSON)
+            out << "\n]" << std::endl;
+    }
+
+public:
+    explicit Benchmark(size_t runs, Format format = CSV)
+        : m_runs(std::max<size_t>(runs, 1))
+        , m_format(format)
+        , m_timeout(0) {}
+
+    // Seconds each input gets for all its runs, or 0 for no limit.
+    void set_timeout(unsigned seconds) {
+        m_timeout = seconds;
+    }
+
+    // Measures `input` in a child, which gets killed if it takes longer than
+    // the timeout, if there's one. Says why on stderr unless it's OK.
+    Status measure(const char* input, Result& result, long& peak_rss_kb) const {
+        int fds[2];
+        if (pipe(fds) < 0) {
+            std::cerr << "pipe: " << strerror(errno) << std::endl;
+            return FAILED;
+        }
+
+        std::cout.flush();
+        pid_t pid = fork();
+        if (pid < 0) {
+            std::cerr << "fork: " << strerror(errno) << std::endl;
+            close(fds[0]);
+            close(fds[1]);
+            return FAILED;
+        }
+
+        if (pid == 0) {
+            close(fds[0]);
+            if (m_timeout)
+                alarm(m_timeout);
+            int status = 0;
+            try {
+                Result measured = measure_runs(input);
+                if (write(fds[1], &measured, sizeof(measured)) != sizeof(measured))
+                    status = 1;
+            } catch (const ParseError& error) {
+                std::cerr << error.what() << std::endl;
+                status = 1;
+            }
+            close(fds[1]);
+            _exit(status);
+        }
+
+        close(fds[1]);
+        ssize_t received;
+        do {
+            received = read(fds[0], &result, sizeof(result));
+        } while (received < 0 && errno == EINTR);
+        close(fds[0]);
+
+        int status;
+        struct rusage usage;
+        while (wait4(pid, &status, 0, &usage) < 0) {
+            if (errno != EINTR) {
+                std::cerr << "wait4: " << strerror(errno) << std::endl;
+                return FAILED;
+            }
+        }
+
+        if (WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM) {
+            std::cerr << input << ": timed out after " << m_timeout << "s" << std::endl;
+            return TIMED_OUT;
+        }
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+            received != static_cast<ssize_t>(sizeof(result))) {
+            std::cerr << input << ": benchmark failed" << std::endl;
+            return FAILED;
+        }
+
+        // Linux reports it in kilobytes.
+        peak_rss_kb = usage.ru_maxrss;
+        return OK;
+    }
+
+
+    // Prints one row per input. Returns false if any of them failed, or
+    // produced an invalid plan.
+    bool run(const std::vector<const char*>& inputs, std::ostream& out) const {
+        bool ok = true;
+        bool first = true;
+        print_header(out);
+        for (const char* input: inputs) {
+            Result result;
+            long peak_rss_kb = 0;
+            if (measure(input, result, peak_rss_kb) != OK) {
+                ok = false;
+                continue;
+            }
+            if (!result.valid) {
+                std::cerr << input << ": the plan doesn't score" << std::endl;
+                ok = false;
+            }
+            print_row(out, input, result, peak_rss_kb, first);
+            first = false;
+        }
+        print_footer(out);
+        return ok;
+    }
+};
+
+// Runs the solver on generated instances of growing size, and plots time and
+// peak memory against it. The time per order should stay flat as long as the
+// solver scales linearly; wherever it climbs is where it falls over.
+//
+// Stops at the first size that fails, or that takes longer than `timeout`
+// seconds.
+class ScaleTest {
+    InstanceConfig m_base;
+    unsigned m_timeout;
+
+    // Bar of up to `width` characters for `value` out of `max`, on a log scale
+    // since the sizes span several orders of magnitude.
+    static std::string bar(double value, double max, size_t width = 30) {
+        if (value <= 1 || max <= 1)
+            return std::string();
+        size_t length = static_cast<size_t>(std::log(value) / std::log(max) * width + 0.5);
+        return std::string(std::min(length, width), '#');
+    }
+
+public:
+    ScaleTest(const InstanceConfig& base, unsigned timeout)
+        : m_base(base)
+        , m_timeout(timeout) {}
+
+    bool run(const std::vector<double>& factors, std::ostream& out) const {
+        struct Row {
+            double factor;
+            size_t orders;
+            Benchmark::Result result;
+            long peak_rss_kb;
+        };
+        std::vector<Row> rows;
+
+        char path[] = "/tmp/qualification-scale-XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0) {
+            std::cerr << "mkstemp: " << strerror(errno) << std::endl;
+            return false;
+        }
+        close(fd);
+
+        Benchmark benchmark(1);
+        benchmark.set_timeout(m_timeout);
+
+        bool ok = true;
+        out << "factor,orders,drones,warehouses,bytes,parse_ms,plan_ms,emit_ms,total_ms,peak_rss_kb,score,status" << std::endl;
+        for (double factor: factors) {
+            InstanceConfig config = m_base.scaled(factor);
+            if (!InstanceGenerator(config).write_to(path)) {
+                std::cerr << path << ": " << strerror(errno) << std::endl;
+                ok = false;
+                break;
+            }
+
+            Row row;
+            row.factor = factor;
+            row.orders = config.orders;
+            Benchmark::Status status = benchmark.measure(path, row.result, row.peak_rss_kb);
+            if (status != Benchmark::OK) {
+                out << factor << "," << config.orders << "," << config.drones << ","
+                    << config.warehouses << ",,,,,,,,"
+                    << (status == Benchmark::TIMED_OUT ? "timeout" : "failed") << std::endl;
+                ok = status == Benchmark::TIMED_OUT;
+                break;
+            }
+
+            const Benchmark::Result& result = row.result;
+            out << factor << "," << config.orders << "," << config.drones << ","
+                << config.warehouses << "," << result.bytes << ","
+                << result.parse.median << "," << result.plan.median << ","
+                << result.emit.median << "," << result.total.median << ","
+                << row.peak_rss_kb << "," << result.score << ",ok" << std::endl;
+            rows.push_back(row);
+        }
+        unlink(path);
+
+        if (rows.empty())
+            return false;
+
+        double max_ms = 0, max_kb = 0;
+        for (auto& row: rows) {
+            max_ms = std::max(max_ms, row.result.total.median);
+            max_kb = std::max<double>(max_kb, row.peak_rss_kb);
+        }
+
+        out << std::endl << "time (log scale), and per thousand orders:" << std::endl;
+        for (auto& row: rows) {
+            double ms = row.result.total.median;
+            out << "  " << std::setw(6) << row.factor << "x " << std::setw(31) << std::left
+                << bar(ms, max_ms) << std::right << std::setw(10) << ms << " ms "
+                << std::setw(10) << ms * 1000 / row.orders << " ms/k" << std::endl;
+        }
+
+        out << std::endl << "peak RSS (log scale), and per thousand orders:" << std::endl;
+        for (auto& row: rows) {
+            double kb = row.peak_rss_kb;
+            out << "  " << std::setw(6) << row.factor << "x " << std::setw(31) << std::left
+                << bar(kb, max_kb) << std::right << std::setw(10) << kb << " KB "
+                << std::setw(10) << kb * 1000 / row.orders << " KB/k" << std::endl;
+        }
+        return ok;
+    }
+};
+
+#endif
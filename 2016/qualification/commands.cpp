@@ -1,57 +1,284 @@
 #include "commands.h"
 
+#include <algorithm>
+#include <utility>
+
+#include <cassert>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
 using namespace std;
 
 
-string LoadCommand::toString(){
-	string ms;
-	ms =""+ std::to_string(droneId)+  " L " + std::to_string(warehouseId) + " " + std::to_string(productType) + " " + std::to_string(count);
-	return ms;
+Command Command::load(size_t drone, size_t warehouse, size_t product, size_t count) {
+	assert(count <= MAX_COUNT);
+	Command command = { LOAD, 0, static_cast<uint16_t>(count), static_cast<uint32_t>(drone), static_cast<uint32_t>(warehouse), static_cast<uint32_t>(product) };
+	return command;
+}
+
+Command Command::unload(size_t drone, size_t warehouse, size_t product, size_t count) {
+	Command command = load(drone, warehouse, product, count);
+	command.type = UNLOAD;
+	return command;
 }
 
-string UnloadCommand::toString(){
-	string ms;
-	ms ="" +std::to_string(droneId)+  " L " + std::to_string(warehouseId) + " " + std::to_string(productType) + " " + std::to_string(count);
-	return ms;
+Command Command::deliver(size_t drone, size_t order, size_t product, size_t count) {
+	Command command = load(drone, order, product, count);
+	command.type = DELIVER;
+	return command;
 }
 
-string DeliverCommand::toString(){
-	string ms;
-	ms =""+std::to_string(droneId) + " D " + std::to_string(orderId) + " " + std::to_string(productType) + " " + std::to_string(count);
-	return ms;
+Command Command::wait(size_t drone, size_t turns) {
+	Command command = { WAIT, 0, 0, static_cast<uint32_t>(drone), static_cast<uint32_t>(turns), 0 };
+	return command;
 }
-	
-	
-	
-LoadCommand::LoadCommand(size_t droneId, size_t warehouseId, size_t productType, size_t count) : droneId(droneId), warehouseId(warehouseId), productType(productType), count(count) {
+
+static void append_number(string& out, uint64_t value) {
+	char digits[20];
+	char* end = digits + sizeof(digits);
+	char* start = end;
+	do {
+		*--start = '0' + value % 10;
+		value /= 10;
+	} while (value);
+	out.append(start, end);
 }
 
-UnloadCommand::UnloadCommand(size_t droneId, size_t warehouseId, size_t productType, size_t count) : droneId(droneId), warehouseId(warehouseId), productType(productType), count(count) {
+static void append_command(string& out, const Command& command) {
+	append_number(out, command.drone);
+	out += ' ';
+	out += static_cast<char>(command.type);
+	out += ' ';
+	append_number(out, command.target);
+	if (command.type != WAIT) {
+		out += ' ';
+		append_number(out, command.product);
+		out += ' ';
+		append_number(out, command.count);
+	}
+	out += '\n';
 }
 
-DeliverCommand::DeliverCommand(size_t droneId, size_t orderId, size_t productType, size_t count) : droneId(droneId), orderId(orderId), productType(productType), count(count) {
+void Plan::serialize(string& out) const {
+	// Around 12 bytes per command.
+	out.reserve(out.size() + m_count * 12);
+	for (auto& drone: m_drones) {
+		for (auto& command: drone)
+			append_command(out, command);
+	}
 }
 
-WaitCommand::WaitCommand(size_t droneId, size_t sleepTurns) : droneId(droneId), sleepTurns(sleepTurns){
+bool Plan::write_to(const char* path) const {
+	string head, body;
+	append_number(head, m_count);
+	head += '\n';
+	serialize(body);
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+
+	struct iovec parts[2];
+	parts[0].iov_base = const_cast<char*>(head.data());
+	parts[0].iov_len = head.size();
+	parts[1].iov_base = const_cast<char*>(body.data());
+	parts[1].iov_len = body.size();
 
+	struct iovec* pending = parts;
+	int pending_count = 2;
+	while (pending_count) {
+		ssize_t written = writev(fd, pending, pending_count);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			int error = errno;
+			close(fd);
+			errno = error;
+			return false;
+		}
+
+		size_t left = static_cast<size_t>(written);
+		while (pending_count && left >= pending->iov_len) {
+			left -= pending->iov_len;
+			pending++;
+			pending_count--;
+		}
+		if (pending_count) {
+			pending->iov_base = static_cast<char*>(pending->iov_base) + left;
+			pending->iov_len -= left;
+		}
+	}
+
+	return close(fd) == 0;
 }
 
-std::ostream& operator<<(std::ostream& out, const LoadCommand& load) {
-	out << load.droneId << " L " << load.warehouseId << " " << load.productType << " " << load.count;
-	return out;
+void Plan::optimize() {
+	// With unloads, somebody can be waiting for the stock to show up, so
+	// every run has to end when it used to: the turns we save become a wait.
+	bool keep_timing = false;
+	for (auto& commands: m_drones) {
+		for (auto& command: commands)
+			keep_timing |= command.type == UNLOAD;
+	}
+
+	m_count = 0;
+	for (auto& commands: m_drones) {
+		vector<Command> optimized;
+		optimized.reserve(commands.size());
+
+		size_t i = 0;
+		while (i < commands.size()) {
+			const Command& first = commands[i];
+
+			if (first.type == WAIT) {
+				size_t turns = 0;
+				for (; i < commands.size() && commands[i].type == WAIT; ++i)
+					turns += commands[i].target;
+				if (i < commands.size() && turns)
+					optimized.push_back(Command::wait(first.drone, turns));
+				continue;
+			}
+
+			// A run of the same command at the same place: sum it up by
+			// product, keeping the order in which they first appear.
+			size_t run_start = optimized.size();
+			size_t first_index = i;
+			for (; i < commands.size() &&
+			       commands[i].type == first.type &&
+			       commands[i].target == first.target; ++i) {
+				const Command& command = commands[i];
+				bool merged = false;
+				for (size_t j = run_start; j < optimized.size(); ++j) {
+					if (optimized[j].product == command.product &&
+					    optimized[j].count + command.count <= Command::MAX_COUNT) {
+						optimized[j].count += command.count;
+						merged = true;
+						break;
+					}
+				}
+				if (!merged)
+					optimized.push_back(command);
+			}
+
+			// Every command of a run after the first takes a turn.
+			size_t saved = (i - first_index) - (optimized.size() - run_start);
+			if (keep_timing && saved && i < commands.size())
+				optimized.push_back(Command::wait(first.drone, saved));
+		}
+
+		commands.swap(optimized);
+		m_count += commands.size();
+	}
 }
 
-std::ostream& operator<<(std::ostream& out, const UnloadCommand& unload) {
-	out << unload.droneId << " U " << unload.warehouseId << " " << unload.productType << " " << unload.count;
-	return out;
+static const char* skip_blanks(const char* p, const char* end) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+		++p;
+	return p;
 }
 
-std::ostream& operator<<(std::ostream& out, const DeliverCommand& deliver) {
-	out << deliver.droneId << " D " << deliver.orderId << " " << deliver.productType << " " << deliver.count;
-	return out;
+static bool read_number(const char*& p, const char* end, uint32_t& out) {
+	p = skip_blanks(p, end);
+	if (p == end || *p < '0' || *p > '9')
+		return false;
+	uint64_t value = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		value = value * 10 + (*p - '0');
+		if (value > UINT32_MAX)
+			return false;
+		++p;
+	}
+	out = static_cast<uint32_t>(value);
+	return true;
+}
+
+bool Plan::parse(const char* p, const char* end,
+                 size_t drone_count, Plan& plan,
+                 vector<vector<uint32_t>>* lines, string& error) {
+	uint32_t line = 0;
+	bool has_header = false;
+	uint32_t header = 0;
+
+	auto fail = [&](uint32_t line, const string& message) {
+		error = "line " + to_string(line) + ": " + message;
+		return false;
+	};
+
+	while (p < end) {
+		const char* eol = find(p, end, '\n');
+		line++;
+
+		const char* q = skip_blanks(p, eol);
+		if (q == eol) {
+			p = eol + 1;
+			continue;
+		}
+
+		uint32_t drone, target = 0, product = 0, count = 0;
+		if (!read_number(q, eol, drone))
+			return fail(line, "expected a drone id");
+
+		q = skip_blanks(q, eol);
+		if (q == eol) {
+			// A line with just a number is the command count header.
+			if (plan.count() || has_header)
+				return fail(line, "expected a command");
+			has_header = true;
+			header = drone;
+			p = eol + 1;
+			continue;
+		}
+
+		if (drone >= drone_count)
+			return fail(line, "no such drone");
+
+		char type = *q++;
+		switch (type) {
+			case LOAD:
+			case UNLOAD:
+			case DELIVER:
+				if (!read_number(q, eol, target) ||
+				    !read_number(q, eol, product) ||
+				    !read_number(q, eol, count))
+					return fail(line, "malformed command");
+				if (count > Command::MAX_COUNT)
+					return fail(line, "too many items in one command");
+				break;
+			case WAIT:
+				if (!read_number(q, eol, target))
+					return fail(line, "malformed command");
+				break;
+			default:
+				return fail(line, string("unknown command type '") + type + "'");
+		}
+
+		if (skip_blanks(q, eol) != eol)
+			return fail(line, "trailing garbage");
+
+		Command command = { static_cast<uint8_t>(type), 0, static_cast<uint16_t>(count), drone, target, product };
+		plan.add(command);
+		if (lines) {
+			lines->resize(drone_count);
+			(*lines)[drone].push_back(line);
+		}
+		p = eol + 1;
+	}
+
+	if (has_header && header != plan.count()) {
+		return fail(1, "header says " + to_string(header) +
+		               " commands, found " + to_string(plan.count()));
+	}
+
+	return true;
 }
 
-std::ostream& operator<<(std::ostream& out, const WaitCommand& wait) {
-	out << wait.droneId << " W " << wait.sleepTurns;
+std::ostream& operator<<(std::ostream& out, const Command& command) {
+	string formatted;
+	append_command(formatted, command);
+	formatted.pop_back();
+	out << formatted;
 	return out;
 }
@@ -3,64 +3,92 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 
-using namespace std;
+#include <cstdint>
 
+using namespace std;
 
-class Command {
-    size_t extra_duration() { return 0; }
-	virtual string toString();
+enum CommandType : uint8_t {
+    LOAD = 'L',
+    UNLOAD = 'U',
+    DELIVER = 'D',
+    WAIT = 'W',
 };
 
-class LoadCommand : public Command {
-public:
-    size_t droneId;
-    size_t warehouseId;
-	size_t productType;
-    size_t count;
+// A drone command, as a plain 16 byte record.
+//
+// `target` is the warehouse for loads and unloads, the order for deliveries,
+// and the number of turns for waits.
+struct Command {
+    uint8_t type;
+    uint8_t unused;
+    uint16_t count;
+    uint32_t drone;
+    uint32_t target;
+    uint32_t product;
 
-	LoadCommand(size_t droneId, size_t warehouseId, size_t productType, size_t count);
-	string toString();
+    static const size_t MAX_COUNT = UINT16_MAX;
 
-    size_t extra_duration() { return 1; }
+    static Command load(size_t drone, size_t warehouse, size_t product, size_t count);
+    static Command unload(size_t drone, size_t warehouse, size_t product, size_t count);
+    static Command deliver(size_t drone, size_t order, size_t product, size_t count);
+    static Command wait(size_t drone, size_t turns);
 };
 
-class UnloadCommand: public Command {
-	public:
-	size_t droneId;
-	size_t warehouseId;
-	size_t productType;
-	size_t count;
-	UnloadCommand(size_t droneId, size_t warehouseId, size_t productType, size_t count);
-	string toString();
+static_assert(sizeof(Command) == 16, "Commands should stay small");
 
-    size_t extra_duration() { return 1; }
-};
+// The commands of every drone, each drone's stored contiguously. That's all the
+// output format needs: the commands of a drone run in order, but drones don't
+// depend on each other's order.
+class Plan {
+    std::vector<std::vector<Command>> m_drones;
+    size_t m_count;
+
+public:
+    explicit Plan(size_t drone_count = 0): m_drones(drone_count), m_count(0) {}
 
-class DeliverCommand: public Command {
-	public:
-	size_t droneId;
-	size_t orderId;
-	size_t productType;
-	size_t count;
-	string toString();
+    void add(const Command& command) {
+        if (command.drone >= m_drones.size())
+            m_drones.resize(command.drone + 1);
+        m_drones[command.drone].push_back(command);
+        m_count++;
+    }
 
-	DeliverCommand(size_t droneId, size_t orderId, size_t productType, size_t count);
+    size_t count() const { return m_count; }
+    size_t drone_count() const { return m_drones.size(); }
 
-    size_t extra_duration() { return 1; }
-};
+    const std::vector<Command>& drone(size_t id) const {
+        return m_drones[id];
+    }
+
+    // Merges the loads (and deliveries) of the same product in a run of loads
+    // from the same warehouse (deliveries to the same order), and collapses
+    // consecutive waits, dropping the ones at the end.
+    //
+    // That makes drones finish earlier, which is only right as long as nobody
+    // depends on stock being unloaded at a given turn. So if there are
+    // unloads, the turns saved by each run are spent waiting at its end
+    // instead: the stock moves the same, just in fewer commands.
+    void optimize();
+
+    // Appends the commands, without the count header.
+    void serialize(std::string& out) const;
+
+    // Writes the count header and the commands with a single writev (well,
+    // unless the kernel decides to do a partial write). Returns false and sets
+    // errno on failure.
+    bool write_to(const char* path) const;
 
-class WaitCommand: public Command {
-	public:
-	size_t droneId;
-	size_t sleepTurns;
-	WaitCommand(size_t droneId, size_t sleepTurns);
-	string toString();
+    // Parses a command file, with or without the count header, for
+    // `drone_count` drones. If `lines` is given, it gets the line of each
+    // command, laid out like the plan.
+    static bool parse(const char* begin, const char* end,
+                      size_t drone_count, Plan& plan,
+                      std::vector<std::vector<uint32_t>>* lines,
+                      std::string& error);
 };
 
-std::ostream& operator<<(std::ostream& out, const LoadCommand& load);
-std::ostream& operator<<(std::ostream& out, const UnloadCommand& unload);
-std::ostream& operator<<(std::ostream& out, const DeliverCommand& deliver);
-std::ostream& operator<<(std::ostream& out, const WaitCommand& wait);
+std::ostream& operator<<(std::ostream& out, const Command& command);
 
 #endif
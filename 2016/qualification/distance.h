@@ -0,0 +1,156 @@
+#ifndef DISTANCE_H
+#define DISTANCE_H
+
+#include <vector>
+#include <cassert>
+#include <cstdint>
+
+#include "point.h"
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <immintrin.h>
+#define DISTANCE_KERNEL_X86 1
+#endif
+
+// Batched distance kernels: distance from one point to many, with the
+// coordinates of the many given as separate x and y arrays.
+//
+// They go through double precision sqrt, which gives exactly the same result
+// as ceil_distance as long as the distances stay below 2^26, way more than any
+// map we'll see.
+const size_t MAX_KERNEL_COORDINATE = 1 << 25;
+
+inline void distances_from_scalar(size_t x, size_t y,
+                                  const int32_t* xs, const int32_t* ys,
+                                  size_t count, uint32_t* out) {
+    for (size_t i = 0; i < count; ++i)
+        out[i] = static_cast<uint32_t>(ceil_distance(x, y, xs[i], ys[i]));
+}
+
+#ifdef DISTANCE_KERNEL_X86
+inline void distances_from_sse2(size_t x, size_t y,
+                                const int32_t* xs, const int32_t* ys,
+                                size_t count, uint32_t* out) {
+    const __m128d px = _mm_set1_pd(static_cast<double>(x));
+    const __m128d py = _mm_set1_pd(static_cast<double>(y));
+    const __m128d one = _mm_set1_pd(1.0);
+
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128d dx = _mm_sub_pd(_mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i*)(xs + i))), px);
+        __m128d dy = _mm_sub_pd(_mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i*)(ys + i))), py);
+        __m128d root = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)));
+
+        // No ceil in SSE2: truncate, and add one where that lost something.
+        __m128d truncated = _mm_cvtepi32_pd(_mm_cvttpd_epi32(root));
+        __m128d ceiled = _mm_add_pd(truncated, _mm_and_pd(_mm_cmplt_pd(truncated, root), one));
+        _mm_storel_epi64((__m128i*)(out + i), _mm_cvttpd_epi32(ceiled));
+    }
+
+    distances_from_scalar(x, y, xs + i, ys + i, count - i, out + i);
+}
+
+__attribute__((target("avx2")))
+inline void distances_from_avx2(size_t x, size_t y,
+                                const int32_t* xs, const int32_t* ys,
+                                size_t count, uint32_t* out) {
+    const __m256d px = _mm256_set1_pd(static_cast<double>(x));
+    const __m256d py = _mm256_set1_pd(static_cast<double>(y));
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d dx = _mm256_sub_pd(_mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(xs + i))), px);
+        __m256d dy = _mm256_sub_pd(_mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(ys + i))), py);
+        __m256d root = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)));
+        _mm_storeu_si128((__m128i*)(out + i), _mm256_cvttpd_epi32(_mm256_ceil_pd(root)));
+    }
+
+    distances_from_scalar(x, y, xs + i, ys + i, count - i, out + i);
+}
+#endif
+
+// Picks the widest kernel the CPU we're running on supports.
+inline void distances_from(size_t x, size_t y,
+                           const int32_t* xs, const int32_t* ys,
+                           size_t count, uint32_t* out) {
+    assert(x < MAX_KERNEL_COORDINATE && y < MAX_KERNEL_COORDINATE);
+#ifdef DISTANCE_KERNEL_X86
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if (has_avx2)
+        distances_from_avx2(x, y, xs, ys, count, out);
+    else
+        distances_from_sse2(x, y, xs, ys, count, out);
+#else
+    distances_from_scalar(x, y, xs, ys, count, out);
+#endif
+}
+
+// Distances between fixed points, computed once after parsing: warehouse to
+// warehouse, and warehouse to order destination (one row per order, since
+// that's the way we look them up).
+//
+// Either table can get huge (ten thousand warehouses make a hundred million
+// pairs), so above MAX_TABLE_ENTRIES we don't build it and compute those on
+// the fly instead.
+class DistanceTables {
+    size_t m_warehouse_count;
+    std::vector<uint32_t> m_warehouse_warehouse;
+    std::vector<uint32_t> m_order_warehouse;
+    std::vector<int32_t> m_warehouse_xs;
+    std::vector<int32_t> m_warehouse_ys;
+    std::vector<Point> m_destinations;
+
+public:
+    static const size_t MAX_TABLE_ENTRIES = 1 << 26;
+
+    explicit DistanceTables(const std::vector<Point>& warehouses = std::vector<Point>(),
+                            const std::vector<Point>& destinations = std::vector<Point>())
+        : m_warehouse_count(warehouses.size())
+        , m_destinations(destinations) {
+        for (auto& position: warehouses) {
+            assert(position.x < MAX_KERNEL_COORDINATE && position.y < MAX_KERNEL_COORDINATE);
+            m_warehouse_xs.push_back(static_cast<int32_t>(position.x));
+            m_warehouse_ys.push_back(static_cast<int32_t>(position.y));
+        }
+
+        if (m_warehouse_count * m_warehouse_count <= MAX_TABLE_ENTRIES) {
+            m_warehouse_warehouse.resize(m_warehouse_count * m_warehouse_count);
+            for (size_t i = 0; i < m_warehouse_count; ++i)
+                fill_row(warehouses[i], &m_warehouse_warehouse[i * m_warehouse_count]);
+        }
+
+        if (m_warehouse_count * destinations.size() <= MAX_TABLE_ENTRIES) {
+            m_order_warehouse.resize(m_warehouse_count * destinations.size());
+            for (size_t i = 0; i < destinations.size(); ++i)
+                fill_row(destinations[i], &m_order_warehouse[i * m_warehouse_count]);
+        }
+    }
+
+    void fill_row(const Point& from, uint32_t* row) const {
+        distances_from(from.x, from.y,
+                       m_warehouse_xs.data(), m_warehouse_ys.data(),
+                       m_warehouse_count, row);
+#ifndef NDEBUG
+        for (size_t i = 0; i < m_warehouse_count; ++i)
+            assert(row[i] == ceil_distance(from.x, from.y, m_warehouse_xs[i], m_warehouse_ys[i]));
+#endif
+    }
+
+    size_t warehouse_to_warehouse(WarehouseId from, WarehouseId to) const {
+        if (m_warehouse_warehouse.empty()) {
+            return ceil_distance(m_warehouse_xs[from], m_warehouse_ys[from],
+                                 m_warehouse_xs[to], m_warehouse_ys[to]);
+        }
+        return m_warehouse_warehouse[size_t(from) * m_warehouse_count + to];
+    }
+
+    size_t warehouse_to_order(WarehouseId warehouse, OrderId order) const {
+        if (m_order_warehouse.empty()) {
+            return ceil_distance(m_warehouse_xs[warehouse], m_warehouse_ys[warehouse],
+                                 m_destinations[order].x, m_destinations[order].y);
+        }
+        return m_order_warehouse[size_t(order) * m_warehouse_count + warehouse];
+    }
+};
+
+#endif
@@ -0,0 +1,277 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+
+// Writes random delivery instances, in the same format as the ones in input/.
+//
+// The same configuration and seed always give the same file: we only take raw
+// numbers from the mt19937_64, whose sequence the standard pins down, and do
+// the rest ourselves instead of relying on the standard distributions.
+struct InstanceConfig {
+    enum OrderSize {
+        UNIFORM,
+        GEOMETRIC,
+    };
+
+    size_t rows;
+    size_t columns;
+    size_t drones;
+    size_t deadline;
+    size_t max_load;
+    size_t products;
+    size_t max_product_weight;
+    size_t warehouses;
+    size_t orders;
+
+    // Items per order: uniform between min_items and max_items, or geometric
+    // with mean (min_items + max_items) / 2, capped at max_items.
+    OrderSize order_size;
+    size_t min_items;
+    size_t max_items;
+
+    // Zipf exponent of product popularity: 0 is uniform, and the larger it
+    // is, the more the first products dominate the orders.
+    double product_skew;
+
+    // How much stock there is beyond what the orders need, as a fraction of
+    // it. It's spread randomly across the warehouses, so even with a lot of
+    // slack some products can still be scarce in some places.
+    double stock_slack;
+
+    uint64_t seed;
+
+    // Roughly busy_day.
+    InstanceConfig()
+        : rows(400)
+        , columns(600)
+        , drones(30)
+        , deadline(100000)
+        , max_load(200)
+        , products(400)
+        , max_product_weight(150)
+        , warehouses(10)
+        , orders(1250)
+        , order_size(UNIFORM)
+        , min_items(1)
+        , max_items(15)
+        , product_skew(0)
+        , stock_slack(0.2)
+        , seed(1) {}
+
+    // `factor` times the drones, warehouses and orders, on a grid with
+    // `factor` times the area. The catalog and the deadline stay the same,
+    // so the input grows linearly (the stock lines are products times
+    // warehouses), and so does the work per drone.
+    InstanceConfig scaled(double factor) const {
+        InstanceConfig config = *this;
+        double side = std::sqrt(factor);
+        auto scale = [](size_t value, double by) {
+            return std::max<size_t>(1, static_cast<size_t>(std::llround(value * by)));
+        };
+        config.rows = scale(rows, side);
+        config.columns = scale(columns, side);
+        config.drones = scale(drones, factor);
+        config.warehouses = scale(warehouses, factor);
+        config.orders = scale(orders, factor);
+        return config;
+    }
+
+    // Sets one option from a "key=value" argument. Returns false if there's
+    // no such key or the value doesn't parse.
+    bool set(const std::string& option) {
+        size_t equals = option.find('=');
+        if (equals == std::string::npos)
+            return false;
+        std::string key = option.substr(0, equals);
+        std::string value = option.substr(equals + 1);
+
+        try {
+            if (key == "sizes") {
+                if (value == "uniform")
+                    order_size = UNIFORM;
+                else if (value == "geometric")
+                    order_size = GEOMETRIC;
+                else
+                    return false;
+            } else if (key == "skew") {
+                product_skew = std::stod(value);
+            } else if (key == "slack") {
+                stock_slack = std::stod(value);
+            } else if (key == "scale") {
+                *this = scaled(std::stod(value));
+            } else {
+                size_t* field = nullptr;
+                if (key == "rows") field = &rows;
+                else if (key == "columns") field = &columns;
+                else if (key == "drones") field = &drones;
+                else if (key == "deadline") field = &deadline;
+                else if (key == "load") field = &max_load;
+                else if (key == "products") field = &products;
+                else if (key == "weight") field = &max_product_weight;
+                else if (key == "warehouses") field = &warehouses;
+                else if (key == "orders") field = &orders;
+                else if (key == "min_items") field = &min_items;
+                else if (key == "max_items") field = &max_items;
+                else if (key == "seed") {
+                    seed = std::stoull(value);
+                    return true;
+                }
+                if (!field)
+                    return false;
+                *field = std::stoul(value);
+            }
+        } catch (const std::exception&) {
+            return false;
+        }
+        return true;
+    }
+
+    // What's wrong with it, or empty if it describes a valid instance.
+    std::string check() const {
+        if (!rows || !columns)
+            return "the grid can't be empty";
+        if (!warehouses)
+            return "there must be at least one warehouse";
+        if (!products)
+            return "there must be at least one product";
+        if (!max_load || !max_product_weight || max_product_weight > max_load)
+            return "product weights must be between 1 and the maximum load";
+        if (!min_items || min_items > max_items)
+            return "the item counts must satisfy 1 <= min_items <= max_items";
+        if (product_skew < 0 || stock_slack < 0)
+            return "skew and slack can't be negative";
+        return std::string();
+    }
+};
+
+class InstanceGenerator {
+    const InstanceConfig& m_config;
+    std::mt19937_64 m_random;
+    std::string m_out;
+
+    // In [0, n). The modulo bias is way below anything we care about here.
+    size_t below(size_t n) {
+        return m_random() % n;
+    }
+
+    // In [0, 1).
+    double unit() {
+        return (m_random() >> 11) * (1.0 / (UINT64_C(1) << 53));
+    }
+
+    size_t order_size() {
+        const InstanceConfig& config = m_config;
+        size_t span = config.max_items - config.min_items;
+        if (config.order_size == InstanceConfig::UNIFORM)
+            return config.min_items + below(span + 1);
+
+        // Failures before the first success, with the mean we want.
+        double mean = span / 2.0;
+        if (mean <= 0)
+            return config.min_items;
+        double p = 1 / (mean + 1);
+        size_t extra = static_cast<size_t>(std::log(1 - unit()) / std::log(1 - p));
+        return config.min_items + std::min(extra, span);
+    }
+
+    void number(uint64_t value, char separator) {
+        char digits[20];
+        char* end = digits + sizeof(digits);
+        char* start = end;
+        do {
+            *--start = '0' + value % 10;
+            value /= 10;
+        } while (value);
+        m_out.append(start, end);
+        m_out += separator;
+    }
+
+public:
+    explicit InstanceGenerator(const InstanceConfig& config)
+        : m_config(config)
+        , m_random(config.seed) {}
+
+    // The whole instance, as text.
+    const std::string& generate() {
+        const InstanceConfig& config = m_config;
+        m_out.clear();
+
+        number(config.rows, ' ');
+        number(config.columns, ' ');
+        number(config.drones, ' ');
+        number(config.deadline, ' ');
+        number(config.max_load, '\n');
+
+        number(config.products, '\n');
+        for (size_t i = 0; i < config.products; ++i)
+            number(1 + below(config.max_product_weight), i + 1 < config.products ? ' ' : '\n');
+
+        // Orders first, so we know how much of everything to stock.
+        std::vector<double> popularity(config.products);
+        double total = 0;
+        for (size_t i = 0; i < config.products; ++i) {
+            total += 1 / std::pow(i + 1, config.product_skew);
+            popularity[i] = total;
+        }
+
+        std::vector<size_t> demand(config.products, 0);
+        std::string orders;
+        orders.swap(m_out);
+        for (size_t i = 0; i < config.orders; ++i) {
+            number(below(config.rows), ' ');
+            number(below(config.columns), '\n');
+
+            size_t items = order_size();
+            number(items, '\n');
+            for (size_t j = 0; j < items; ++j) {
+                double key = unit() * total;
+                size_t product = std::upper_bound(popularity.begin(), popularity.end(), key) - popularity.begin();
+                product = std::min(product, config.products - 1);
+                demand[product]++;
+                number(product, j + 1 < items ? ' ' : '\n');
+            }
+        }
+        orders.swap(m_out);
+
+        std::vector<size_t> stock(config.warehouses * config.products, 0);
+        for (size_t product = 0; product < config.products; ++product) {
+            size_t units = static_cast<size_t>(std::ceil(demand[product] * (1 + config.stock_slack)));
+            for (size_t i = 0; i < units; ++i)
+                stock[below(config.warehouses) * config.products + product]++;
+        }
+
+        number(config.warehouses, '\n');
+        for (size_t warehouse = 0; warehouse < config.warehouses; ++warehouse) {
+            number(below(config.rows), ' ');
+            number(below(config.columns), '\n');
+            for (size_t product = 0; product < config.products; ++product)
+                number(stock[warehouse * config.products + product],
+                       product + 1 < config.products ? ' ' : '\n');
+        }
+
+        number(config.orders, '\n');
+        m_out += orders;
+        return m_out;
+    }
+
+    // Generates the instance into `path`. Returns false and sets errno on
+    // failure.
+    bool write_to(const char* path) {
+        const std::string& text = generate();
+        FILE* file = fopen(path, "w");
+        if (!file)
+            return false;
+        bool ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+        return fclose(file) == 0 && ok;
+    }
+};
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <iostream>
+#include <chrono>
+
+#include <cstdint>
+
+// Counters and timers for the solver. Build with -DNO_INSTRUMENTATION and they
+// compile down to nothing.
+//
+// Counters are plain increments, so they're always on. Timers read the clock
+// twice per scope, which adds up in the spatial queries, so they only run once
+// somebody asks for them with enable_timers().
+//
+// Every Simulation has its own, so strategies running on their own copies
+// don't share anything.
+#ifdef NO_INSTRUMENTATION
+#define INSTRUMENTATION_ENABLED 0
+#else
+#define INSTRUMENTATION_ENABLED 1
+#endif
+
+class Instrumentation {
+public:
+    enum Counter {
+        NEAREST_WAREHOUSE_QUERIES,
+        DRONE_QUERIES,
+        ORDER_QUERIES,
+        COMMANDS_EMITTED,
+        TURNS_SIMULATED,
+        TURNS_SKIPPED,
+        REBALANCING_TRIPS,
+        REBALANCED_ITEMS,
+        COUNTER_COUNT,
+    };
+
+    enum Timer {
+        PARSE,
+        PLAN,
+        NEAREST_WAREHOUSE,
+        NEAREST_DRONE,
+        NEAREST_ORDER,
+        EMIT,
+        TIMER_COUNT,
+    };
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    uint64_t m_counters[COUNTER_COUNT];
+    uint64_t m_nanoseconds[TIMER_COUNT];
+    uint64_t m_calls[TIMER_COUNT];
+    bool m_timing;
+
+public:
+    Instrumentation(): m_timing(false) {
+        for (size_t i = 0; i < COUNTER_COUNT; ++i)
+            m_counters[i] = 0;
+        for (size_t i = 0; i < TIMER_COUNT; ++i)
+            m_nanoseconds[i] = m_calls[i] = 0;
+    }
+
+    void enable_timers(bool enabled = true) {
+        m_timing = INSTRUMENTATION_ENABLED && enabled;
+    }
+
+    bool timing() const {
+        return m_timing;
+    }
+
+    void count(Counter counter, uint64_t amount = 1) {
+        if (INSTRUMENTATION_ENABLED)
+            m_counters[counter] += amount;
+    }
+
+    uint64_t counter(Counter counter) const {
+        return m_counters[counter];
+    }
+
+    void add_time(Timer timer, uint64_t nanoseconds) {
+        if (INSTRUMENTATION_ENABLED) {
+            m_nanoseconds[timer] += nanoseconds;
+            m_calls[timer]++;
+        }
+    }
+
+    // Times its own lifetime into `timer`, if timers are on.
+    class Scope {
+#if INSTRUMENTATION_ENABLED
+        Instrumentation& m_instrumentation;
+        Timer m_timer;
+        bool m_active;
+        Clock::time_point m_start;
+
+    public:
+        Scope(Instrumentation& instrumentation, Timer timer)
+            : m_instrumentation(instrumentation)
+            , m_timer(timer)
+            , m_active(instrumentation.m_timing) {
+            if (m_active)
+                m_start = Clock::now();
+        }
+
+        ~Scope() {
+            if (m_active) {
+                auto elapsed = Clock::now() - m_start;
+                m_instrumentation.add_time(m_timer,
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+            }
+        }
+#else
+    public:
+        Scope(Instrumentation&, Timer) {}
+#endif
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    void print_json(std::ostream& out) const {
+        static const char* COUNTERS[] = {
+            "nearest_warehouse_queries", "drone_queries", "order_queries",
+            "commands_emitted", "turns_simulated", "turns_skipped",
+            "rebalancing_trips", "rebalanced_items",
+        };
+        static const char* TIMERS[] = {
+            "parse", "plan", "nearest_warehouse", "nearest_drone",
+            "nearest_order", "emit",
+        };
+        static_assert(sizeof(COUNTERS) / sizeof(*COUNTERS) == COUNTER_COUNT, "Missing counter names");
+        static_assert(sizeof(TIMERS) / sizeof(*TIMERS) == TIMER_COUNT, "Missing timer names");
+
+        out << "{\"instrumentation\": " << (INSTRUMENTATION_ENABLED ? "true" : "false")
+            << ", \"counters\": {";
+        for (size_t i = 0; i < COUNTER_COUNT; ++i)
+            out << (i ? ", " : "") << "\"" << COUNTERS[i] << "\": " << m_counters[i];
+        out << "}, \"timers\": {";
+        bool first = true;
+        for (size_t i = 0; i < TIMER_COUNT; ++i) {
+            if (!m_calls[i])
+                continue;
+            out << (first ? "" : ", ") << "\"" << TIMERS[i] << "\": {\"calls\": " << m_calls[i]
+                << ", \"ms\": " << m_nanoseconds[i] / 1e6 << "}";
+            first = false;
+        }
+        out << "}}" << std::endl;
+    }
+};
+
+// Prints how far the planner got, at most once every `interval` seconds no
+// matter how often it's told.
+class ProgressReporter {
+    typedef std::chrono::steady_clock Clock;
+
+    std::ostream& m_out;
+    Clock::duration m_interval;
+    Clock::time_point m_start;
+    Clock::time_point m_next;
+
+public:
+    explicit ProgressReporter(std::ostream& out, double interval = 1.0)
+        : m_out(out)
+        , m_interval(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(interval)))
+        , m_start(Clock::now())
+        , m_next(m_start + m_interval) {}
+
+    void update(size_t turn, size_t deadline, size_t pending_orders) {
+        Clock::time_point now = Clock::now();
+        if (now < m_next)
+            return;
+        m_next = now + m_interval;
+        m_out << "turn " << turn << " / " << deadline << ", "
+              << pending_orders << " orders pending, "
+              << std::chrono::duration<double>(now - m_start).count() << "s" << std::endl;
+    }
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef INVENTORY_H
+#define INVENTORY_H
+
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+#include "point.h"
+
+// Inverted index from a product to the warehouses that still have it in
+// stock.
+//
+// The inventory keeps it up to date (see Inventory::take), so the lookups only
+// have to look at the warehouses that can actually serve the product.
+class StockIndex {
+    std::vector<std::vector<WarehouseId>> m_holders;
+
+public:
+    explicit StockIndex(size_t product_count = 0): m_holders(product_count) {}
+
+    // The warehouse must not be a holder already. The inventory only adds
+    // it when its stock goes from zero to something, and looking for it
+    // first would make loading ten thousand warehouses quadratic.
+    void add(ProductId product, WarehouseId warehouse) {
+        if (product >= m_holders.size())
+            m_holders.resize(product + 1);
+        m_holders[product].push_back(warehouse);
+    }
+
+    // Only happens when a warehouse runs out of a product, so a linear
+    // search is fine here.
+    void remove(ProductId product, WarehouseId warehouse) {
+        assert(product < m_holders.size());
+        auto& holders = m_holders[product];
+        auto it = std::find(holders.begin(), holders.end(), warehouse);
+        assert(it != holders.end());
+        *it = holders.back();
+        holders.pop_back();
+    }
+
+    const std::vector<WarehouseId>& holders(ProductId product) const {
+        static const std::vector<WarehouseId> none;
+        if (product >= m_holders.size())
+            return none;
+        return m_holders[product];
+    }
+};
+
+// Stock of every product in every warehouse, as a dense warehouse x product
+// matrix (product ids are dense, so there's no point in hashing them).
+// Warehouses are just views into their row.
+class Inventory {
+public:
+    typedef uint32_t Count;
+
+private:
+    size_t m_product_count;
+    std::vector<Count> m_counts;
+    StockIndex m_stock_index;
+
+    Count& at(WarehouseId warehouse, ProductId product) {
+        assert(product < m_product_count);
+        return m_counts[warehouse * m_product_count + product];
+    }
+
+public:
+    explicit Inventory(size_t warehouse_count = 0, size_t product_count = 0)
+        : m_product_count(product_count)
+        , m_counts(warehouse_count * product_count, 0)
+        , m_stock_index(product_count) {}
+
+    Count count(WarehouseId warehouse, ProductId product) const {
+        assert(product < m_product_count);
+        return m_counts[warehouse * m_product_count + product];
+    }
+
+    void set(WarehouseId warehouse, ProductId product, size_t amount) {
+        assert(amount <= UINT32_MAX);
+        Count& count = at(warehouse, product);
+        if (!count && amount)
+            m_stock_index.add(product, warehouse);
+        else if (count && !amount)
+            m_stock_index.remove(product, warehouse);
+        count = static_cast<Count>(amount);
+    }
+
+    void take(WarehouseId warehouse, ProductId product, size_t amount) {
+        Count& count = at(warehouse, product);
+        assert(count >= amount);
+        count -= amount;
+        if (!count)
+            m_stock_index.remove(product, warehouse);
+    }
+
+    const std::vector<WarehouseId>& holders(ProductId product) const {
+        return m_stock_index.holders(product);
+    }
+};
+
+#endif
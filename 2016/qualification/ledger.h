@@ -0,0 +1,101 @@
+#ifndef LEDGER_H
+#define LEDGER_H
+
+#include <atomic>
+#include <memory>
+
+#include <cassert>
+#include <cstdint>
+
+#include "point.h"
+#include "inventory.h"
+
+// Stock and drones promised to trips that are planned but not applied yet, so
+// several threads can plan against the same Simulation at once.
+//
+// The inventory itself isn't touched until a trip gets applied, which only
+// happens on one thread, with nobody planning meanwhile. Until then it's the
+// reserved counts that change, with compare-and-swap: a reservation only goes
+// through if what the warehouse has minus what's already reserved there still
+// covers it, so whatever holds a reservation can count on getting the stock.
+// Drones are claimed the same way, by whoever swaps their owner from INVALID
+// to their own id first.
+class ReservationLedger {
+    const Inventory& m_inventory;
+    size_t m_product_count;
+    size_t m_drone_count;
+
+    // Warehouse x product, like the inventory.
+    std::unique_ptr<std::atomic<uint32_t>[]> m_reserved;
+
+    // Per drone, who claimed it, or INVALID.
+    std::unique_ptr<std::atomic<uint32_t>[]> m_owners;
+
+    std::atomic<uint32_t>& reserved(WarehouseId warehouse, ProductId product) const {
+        assert(product < m_product_count);
+        return m_reserved[size_t(warehouse) * m_product_count + product];
+    }
+
+public:
+    ReservationLedger(const Inventory& inventory, size_t warehouse_count,
+                      size_t product_count, size_t drone_count)
+        : m_inventory(inventory)
+        , m_product_count(product_count)
+        , m_drone_count(drone_count)
+        , m_reserved(new std::atomic<uint32_t>[warehouse_count * product_count])
+        , m_owners(new std::atomic<uint32_t>[drone_count]) {
+        for (size_t i = 0; i < warehouse_count * product_count; ++i)
+            m_reserved[i].store(0, std::memory_order_relaxed);
+        for (size_t i = 0; i < drone_count; ++i)
+            m_owners[i].store(INVALID, std::memory_order_relaxed);
+    }
+
+    ReservationLedger(const ReservationLedger&) = delete;
+    ReservationLedger& operator=(const ReservationLedger&) = delete;
+
+    // What's left at the warehouse once the reservations are served.
+    size_t available(WarehouseId warehouse, ProductId product) const {
+        size_t stock = m_inventory.count(warehouse, product);
+        size_t taken = reserved(warehouse, product).load();
+        assert(taken <= stock);
+        return stock - taken;
+    }
+
+    bool try_reserve(WarehouseId warehouse, ProductId product, uint32_t count) {
+        size_t stock = m_inventory.count(warehouse, product);
+        std::atomic<uint32_t>& slot = reserved(warehouse, product);
+        uint32_t taken = slot.load();
+        do {
+            if (stock - taken < count)
+                return false;
+        } while (!slot.compare_exchange_weak(taken, taken + count));
+        return true;
+    }
+
+    // Gives back a reservation, either because the trip fell through or
+    // because it's been applied and the inventory has the real count now.
+    void release(WarehouseId warehouse, ProductId product, uint32_t count) {
+        uint32_t before = reserved(warehouse, product).fetch_sub(count);
+        assert(before >= count);
+        (void)before;
+    }
+
+    bool try_claim(DroneId drone, uint32_t owner) {
+        assert(drone < m_drone_count && owner != INVALID);
+        uint32_t expected = INVALID;
+        return m_owners[drone].compare_exchange_strong(expected, owner);
+    }
+
+    uint32_t owner(DroneId drone) const {
+        return m_owners[drone].load();
+    }
+
+    void release_drone(DroneId drone, uint32_t owner) {
+        uint32_t expected = owner;
+        bool released = m_owners[drone].compare_exchange_strong(expected, INVALID);
+        assert(released);
+        (void)released;
+    }
+};
+
+#endif
@@ -0,0 +1,776 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <utility>
+
+#include <cassert>
+#include <cstdint>
+
+#include "commands.h"
+#include "simulation.h"
+
+// Improves a plan with late acceptance hill climbing over whole trips.
+//
+// A trip is a drone loading at one warehouse and then delivering to one or
+// more orders. Without unloads, nothing a trip does depends on when the other
+// trips happen: every load comes out of the initial stock, and the total taken
+// from each warehouse doesn't change as long as the trips keep their
+// warehouse. So trips can be moved around and between drones freely, and the
+// only things to check are the payload and the deadline.
+//
+// Moves:
+//  - Relocating a trip to another place in the same or another drone.
+//  - Swapping two trips.
+//  - Swapping two stops of a trip, so the other order gets served first.
+//  - Moving one item to another trip from the same warehouse.
+//
+// After a move only the drones it touched get their timeline recomputed, from
+// the first trip that changed on, and only the orders served by those trips
+// get their completion turn recomputed. Moves are applied, scored, and undone
+// if they aren't accepted.
+class LocalSearch {
+    typedef std::pair<ProductId, uint32_t> Entry;
+
+    // Most orders a trip can serve. Same as the planner's.
+    static const size_t MAX_STOPS = 4;
+
+    struct Stop {
+        OrderId order;
+        std::vector<Entry> items;
+    };
+
+    // What a trip does. It only changes with item moves.
+    struct Trip {
+        WarehouseId warehouse;
+        std::vector<Entry> loads;
+        std::vector<Stop> stops;
+        size_t weight;
+
+        bool empty() const { return loads.empty(); }
+
+        Stop* stop_for(OrderId order) {
+            for (auto& stop: stops) {
+                if (stop.order == order)
+                    return &stop;
+            }
+            return nullptr;
+        }
+    };
+
+    // What retiming a trip needs, in a single cache line. Offsets are the turn
+    // of the last delivery of each stop from reaching the warehouse, the
+    // duration is from then until the trip ends.
+    struct Timing {
+        uint32_t warehouse;
+        uint32_t duration;
+        uint32_t end_turn;
+        uint32_t stop_count;
+        uint32_t orders[MAX_STOPS];
+        uint32_t offsets[MAX_STOPS];
+        uint32_t last_turns[MAX_STOPS];
+    };
+
+    static_assert(sizeof(Timing) == 64, "Timings should fit in a cache line");
+
+    // Where a trip is.
+    struct Slot {
+        uint32_t drone;
+        uint32_t position;
+    };
+
+    // The turn an order gets completed is the latest of its stops, which is
+    // kept along with the trip it's in. As long as that trip doesn't get any
+    // earlier, updates don't need to look at the other trips.
+    struct OrderState {
+        uint32_t score;
+        uint32_t last_turn;
+        uint32_t last_trip;
+        bool complete;
+    };
+
+    struct Move {
+        enum Kind {
+            RELOCATE,
+            SWAP,
+            SWAP_STOPS,
+            SHIFT_ITEM,
+        };
+
+        Kind kind;
+        uint32_t trip;
+        uint32_t other;
+        // Where the trip goes, for relocations. Where it was, after applying
+        // it, so it can be undone.
+        uint32_t drone;
+        uint32_t position;
+        // The item that moves from `trip` to `other`.
+        uint32_t stop;
+        uint32_t entry;
+        // The stop of `trip` that trades places with `stop`.
+        uint32_t other_stop;
+    };
+
+    // What an item move needs to be undone.
+    struct Backup {
+        Trip trip;
+        Trip other;
+        Timing trip_timing;
+        Timing other_timing;
+        std::vector<uint32_t> order_trips;
+    };
+
+    const Simulation& m_simulation;
+    const size_t m_deadline;
+
+    std::vector<Trip> m_trips;
+    std::vector<Timing> m_timings;
+    std::vector<Slot> m_slots;
+    std::vector<std::vector<uint32_t>> m_drones;
+    std::vector<size_t> m_drone_end;
+    std::vector<std::vector<uint32_t>> m_warehouse_trips;
+
+    // The trips delivering to each order.
+    std::vector<std::vector<uint32_t>> m_order_trips;
+    std::vector<OrderState> m_order_states;
+    size_t m_score;
+
+    // Orders whose latest stop got earlier in the current move, so they need
+    // to look at all their trips, deduplicated with the stamps.
+    std::vector<OrderId> m_touched;
+    std::vector<size_t> m_touched_stamp;
+    size_t m_stamp;
+
+    bool m_supported;
+
+    // Every entry becomes a command, which can't carry more than
+    // Command::MAX_COUNT items, so what doesn't fit in the entries of the
+    // product there are goes into new ones.
+    static void add_entry(std::vector<Entry>& entries, ProductId product, uint32_t count) {
+        for (auto& entry: entries) {
+            if (!count)
+                return;
+            if (entry.first == product && entry.second < Command::MAX_COUNT) {
+                uint32_t added = std::min<uint32_t>(count, Command::MAX_COUNT - entry.second);
+                entry.second += added;
+                count -= added;
+            }
+        }
+        while (count) {
+            uint32_t added = std::min<uint32_t>(count, Command::MAX_COUNT);
+            entries.push_back(Entry(product, added));
+            count -= added;
+        }
+    }
+
+    // How many of each product the entries add up to, by product.
+    static std::vector<Entry> totals(const std::vector<Entry>& entries) {
+        std::vector<Entry> sorted(entries);
+        std::sort(sorted.begin(), sorted.end());
+        std::vector<Entry> result;
+        for (auto& entry: sorted) {
+            if (!result.empty() && result.back().first == entry.first)
+                result.back().second += entry.second;
+            else
+                result.push_back(entry);
+        }
+        return result;
+    }
+
+    static void remove_one(std::vector<Entry>& entries, ProductId product) {
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (entries[i].first == product) {
+                if (!--entries[i].second)
+                    entries.erase(entries.begin() + i);
+                return;
+            }
+        }
+        assert(0 && "Removing an item that isn't there");
+    }
+
+    void measure(uint32_t id) {
+        const Trip& trip = m_trips[id];
+        Timing& timing = m_timings[id];
+        assert(trip.stops.size() <= MAX_STOPS);
+
+        size_t duration = trip.loads.size();
+        for (size_t s = 0; s < trip.stops.size(); ++s) {
+            const Stop& stop = trip.stops[s];
+            duration += s == 0
+                ? m_simulation.m_distances->warehouse_to_order(trip.warehouse, stop.order)
+                : m_simulation.m_orders[trip.stops[s - 1].order].destination.distance(
+                      m_simulation.m_orders[stop.order].destination);
+            timing.orders[s] = stop.order;
+            timing.offsets[s] = duration + stop.items.size() - 1;
+            duration += stop.items.size();
+        }
+
+        timing.warehouse = trip.warehouse;
+        timing.duration = duration;
+        timing.stop_count = trip.stops.size();
+    }
+
+    void touch(OrderId order) {
+        if (m_touched_stamp[order] == m_stamp)
+            return;
+        m_touched_stamp[order] = m_stamp;
+        m_touched.push_back(order);
+    }
+
+    uint32_t score_at(size_t turn, OrderId order) const {
+        if (!m_order_states[order].complete || turn >= m_deadline)
+            return 0;
+        return (100 * (m_deadline - turn) + m_deadline - 1) / m_deadline;
+    }
+
+    void settle(OrderId order) {
+        OrderState& state = m_order_states[order];
+        uint32_t score = score_at(state.last_turn, order);
+        m_score = m_score - state.score + score;
+        state.score = score;
+    }
+
+    void find_last_stop(OrderId order) {
+        OrderState& state = m_order_states[order];
+        state.last_turn = 0;
+        state.last_trip = UINT32_MAX;
+        for (auto id: m_order_trips[order]) {
+            const Timing& timing = m_timings[id];
+            for (uint32_t s = 0; s < timing.stop_count; ++s) {
+                if (timing.orders[s] == order && timing.last_turns[s] >= state.last_turn) {
+                    state.last_turn = timing.last_turns[s];
+                    state.last_trip = id;
+                }
+            }
+        }
+        settle(order);
+    }
+
+    void update_stop(OrderId order, uint32_t trip, uint32_t last_turn) {
+        OrderState& state = m_order_states[order];
+        if (last_turn > state.last_turn || (last_turn == state.last_turn && trip != state.last_trip)) {
+            state.last_turn = last_turn;
+            state.last_trip = trip;
+            settle(order);
+        } else if (trip == state.last_trip && last_turn != state.last_turn) {
+            touch(order);
+        }
+    }
+
+    // Recomputes the timeline of the drone from the trip at `from` on.
+    void retime(uint32_t drone, size_t from) {
+        const auto& distances = *m_simulation.m_distances;
+        const auto& sequence = m_drones[drone];
+
+        // Where the drone is: the first warehouse until it delivers something.
+        OrderId at_order = INVALID;
+        size_t free = 0;
+
+        for (size_t i = from; i-- > 0;) {
+            const Timing& previous = m_timings[sequence[i]];
+            if (!previous.stop_count)
+                continue;
+            at_order = previous.orders[previous.stop_count - 1];
+            free = previous.end_turn;
+            break;
+        }
+
+        for (size_t i = from; i < sequence.size(); ++i) {
+            Timing& timing = m_timings[sequence[i]];
+            if (!timing.stop_count) {
+                timing.end_turn = free;
+                continue;
+            }
+
+            free += at_order == INVALID
+                ? distances.warehouse_to_warehouse(0, timing.warehouse)
+                : distances.warehouse_to_order(timing.warehouse, at_order);
+
+            for (uint32_t s = 0; s < timing.stop_count; ++s) {
+                timing.last_turns[s] = std::min<size_t>(free + timing.offsets[s], UINT32_MAX);
+                update_stop(timing.orders[s], sequence[i], timing.last_turns[s]);
+            }
+
+            free += timing.duration;
+            timing.end_turn = std::min<size_t>(free, UINT32_MAX);
+            at_order = timing.orders[timing.stop_count - 1];
+        }
+
+        m_drone_end[drone] = free;
+    }
+
+    void begin_move() {
+        m_stamp++;
+        m_touched.clear();
+    }
+
+    // Updates the score with the touched orders.
+    void rescore() {
+        for (auto order: m_touched)
+            find_last_stop(order);
+    }
+
+    // Same, and returns whether the drones still make it by the deadline.
+    bool end_move(uint32_t drone, uint32_t other_drone) {
+        rescore();
+        return m_drone_end[drone] <= m_deadline && m_drone_end[other_drone] <= m_deadline;
+    }
+
+    // Recomputes everything, after replacing the trips wholesale.
+    void retime_all() {
+        for (auto& trips: m_order_trips)
+            trips.clear();
+        for (uint32_t i = 0; i < m_trips.size(); ++i) {
+            for (auto& stop: m_trips[i].stops)
+                m_order_trips[stop.order].push_back(i);
+        }
+
+        begin_move();
+        for (uint32_t drone = 0; drone < m_drones.size(); ++drone)
+            retime(drone, 0);
+        for (OrderId order = 0; order < m_order_states.size(); ++order)
+            touch(order);
+        rescore();
+    }
+
+    void renumber(uint32_t drone, size_t from) {
+        auto& sequence = m_drones[drone];
+        for (size_t i = from; i < sequence.size(); ++i) {
+            m_slots[sequence[i]].drone = drone;
+            m_slots[sequence[i]].position = i;
+        }
+    }
+
+    void retime_both(uint32_t drone, size_t position, uint32_t other_drone, size_t other_position) {
+        if (drone == other_drone) {
+            retime(drone, std::min(position, other_position));
+        } else {
+            retime(drone, position);
+            retime(other_drone, other_position);
+        }
+    }
+
+    // Moves the trip to `position` in `drone`, leaving in `move` where it was.
+    bool relocate(Move& move) {
+        Slot from = m_slots[move.trip];
+
+        m_drones[from.drone].erase(m_drones[from.drone].begin() + from.position);
+        renumber(from.drone, from.position);
+        auto& target = m_drones[move.drone];
+        target.insert(target.begin() + move.position, move.trip);
+        renumber(move.drone, move.position);
+
+        begin_move();
+        retime_both(from.drone, from.position, move.drone, move.position);
+        uint32_t to_drone = move.drone;
+        move.drone = from.drone;
+        move.position = from.position;
+        return end_move(from.drone, to_drone);
+    }
+
+    bool swap(const Move& move) {
+        Slot& a = m_slots[move.trip];
+        Slot& b = m_slots[move.other];
+        std::swap(m_drones[a.drone][a.position], m_drones[b.drone][b.position]);
+        std::swap(a, b);
+
+        begin_move();
+        retime_both(a.drone, a.position, b.drone, b.position);
+        return end_move(a.drone, b.drone);
+    }
+
+    // Only the trip's own timing changes, and with it the drone's from there.
+    bool swap_stops(const Move& move) {
+        Trip& trip = m_trips[move.trip];
+        std::swap(trip.stops[move.stop], trip.stops[move.other_stop]);
+        measure(move.trip);
+
+        const Slot& slot = m_slots[move.trip];
+        begin_move();
+        retime(slot.drone, slot.position);
+        return end_move(slot.drone, slot.drone);
+    }
+
+    bool shift_item(const Move& move, Backup& backup) {
+        Trip& from = m_trips[move.trip];
+        Trip& to = m_trips[move.other];
+        OrderId order = from.stops[move.stop].order;
+        backup.trip = from;
+        backup.other = to;
+        backup.trip_timing = m_timings[move.trip];
+        backup.other_timing = m_timings[move.other];
+        backup.order_trips = m_order_trips[order];
+
+        ProductId product = from.stops[move.stop].items[move.entry].first;
+        size_t weight = m_simulation.m_products[product].weight;
+
+        std::vector<uint32_t> trips(m_order_trips[order]);
+        remove_one(from.loads, product);
+        remove_one(from.stops[move.stop].items, product);
+        from.weight -= weight;
+        if (from.stops[move.stop].items.empty()) {
+            from.stops.erase(from.stops.begin() + move.stop);
+            trips.erase(std::find(trips.begin(), trips.end(), move.trip));
+        }
+
+        add_entry(to.loads, product, 1);
+        to.weight += weight;
+        Stop* stop = to.stop_for(order);
+        if (!stop) {
+            Stop fresh;
+            fresh.order = order;
+            to.stops.push_back(fresh);
+            stop = &to.stops.back();
+            trips.push_back(move.other);
+        }
+        add_entry(stop->items, product, 1);
+
+        m_order_trips[order] = trips;
+        measure(move.trip);
+        measure(move.other);
+
+        const Slot& a = m_slots[move.trip];
+        const Slot& b = m_slots[move.other];
+        begin_move();
+        touch(order);
+        retime_both(a.drone, a.position, b.drone, b.position);
+        return end_move(a.drone, b.drone);
+    }
+
+    void undo(Move& move, const Backup& backup) {
+        switch (move.kind) {
+            case Move::RELOCATE:
+                relocate(move);
+                break;
+            case Move::SWAP:
+                swap(move);
+                break;
+            case Move::SWAP_STOPS:
+                swap_stops(move);
+                break;
+            case Move::SHIFT_ITEM: {
+                OrderId order = backup.trip.stops[move.stop].order;
+                m_trips[move.trip] = backup.trip;
+                m_trips[move.other] = backup.other;
+                m_timings[move.trip] = backup.trip_timing;
+                m_timings[move.other] = backup.other_timing;
+                m_order_trips[order] = backup.order_trips;
+
+                const Slot& a = m_slots[move.trip];
+                const Slot& b = m_slots[move.other];
+                begin_move();
+                touch(order);
+                retime_both(a.drone, a.position, b.drone, b.position);
+                end_move(a.drone, b.drone);
+                break;
+            }
+        }
+    }
+
+    template<typename Random>
+    bool random_move(Random& random, Move& move) {
+        std::uniform_int_distribution<uint32_t> kinds(0, 11);
+        uint32_t kind = kinds(random);
+        std::uniform_int_distribution<uint32_t> trips(0, m_trips.size() - 1);
+        move.trip = trips(random);
+        const Slot& slot = m_slots[move.trip];
+
+        if (kind < 4) {
+            move.kind = Move::RELOCATE;
+            std::uniform_int_distribution<uint32_t> drones(0, m_drones.size() - 1);
+            move.drone = drones(random);
+            size_t slots = m_drones[move.drone].size();
+            if (move.drone == slot.drone)
+                slots--;
+            std::uniform_int_distribution<uint32_t> positions(0, slots);
+            move.position = positions(random);
+            return move.drone != slot.drone || move.position != slot.position;
+        }
+
+        if (kind < 7) {
+            move.kind = Move::SWAP;
+            move.other = trips(random);
+            return move.other != move.trip;
+        }
+
+        if (kind < 9) {
+            move.kind = Move::SWAP_STOPS;
+            size_t stop_count = m_trips[move.trip].stops.size();
+            if (stop_count < 2)
+                return false;
+            std::uniform_int_distribution<uint32_t> stops(0, stop_count - 1);
+            move.stop = stops(random);
+            move.other_stop = stops(random);
+            return move.stop != move.other_stop;
+        }
+
+        move.kind = Move::SHIFT_ITEM;
+        const Trip& from = m_trips[move.trip];
+        if (from.empty())
+            return false;
+
+        const auto& candidates = m_warehouse_trips[from.warehouse];
+        std::uniform_int_distribution<uint32_t> others(0, candidates.size() - 1);
+        move.other = candidates[others(random)];
+        if (move.other == move.trip)
+            return false;
+
+        std::uniform_int_distribution<uint32_t> stops(0, from.stops.size() - 1);
+        move.stop = stops(random);
+        const Stop& stop = from.stops[move.stop];
+        std::uniform_int_distribution<uint32_t> entries(0, stop.items.size() - 1);
+        move.entry = entries(random);
+
+        Trip& to = m_trips[move.other];
+        if (!to.stop_for(stop.order) && to.stops.size() == MAX_STOPS)
+            return false;
+
+        ProductId product = stop.items[move.entry].first;
+        return to.weight + m_simulation.m_products[product].weight <= m_simulation.m_drone_max_load;
+    }
+
+    bool apply(Move& move, Backup& backup) {
+        switch (move.kind) {
+            case Move::RELOCATE:
+                return relocate(move);
+            case Move::SWAP:
+                return swap(move);
+            case Move::SWAP_STOPS:
+                return swap_stops(move);
+            case Move::SHIFT_ITEM:
+                return shift_item(move, backup);
+        }
+        return false;
+    }
+
+public:
+    struct Stats {
+        size_t iterations;
+        size_t accepted;
+        size_t improvements;
+        size_t initial_score;
+        size_t best_score;
+        double seconds;
+
+        Stats()
+            : iterations(0), accepted(0), improvements(0)
+            , initial_score(0), best_score(0), seconds(0) {}
+
+        void print(std::ostream& out) const {
+            out << "local search: " << initial_score << " -> " << best_score << ", "
+                << iterations << " moves (" << accepted << " accepted, "
+                << improvements << " improvements) in " << seconds << "s, "
+                << (seconds > 0 ? iterations / seconds : 0) << " moves/s" << std::endl;
+        }
+    };
+
+    // Builds the trips from the plan. Waits are dropped: drones start their
+    // next trip as soon as they're done with the previous one.
+    explicit LocalSearch(const Simulation& simulation, const Plan& plan)
+        : m_simulation(simulation)
+        , m_deadline(simulation.m_turns_deadline)
+        , m_drones(simulation.m_drones.size())
+        , m_drone_end(simulation.m_drones.size(), 0)
+        , m_warehouse_trips(simulation.m_warehouses.size())
+        , m_order_trips(simulation.m_orders.size())
+        , m_order_states(simulation.m_orders.size())
+        , m_score(0)
+        , m_touched_stamp(simulation.m_orders.size(), 0)
+        , m_stamp(0)
+        , m_supported(plan.drone_count() <= simulation.m_drones.size() &&
+                      m_deadline < UINT32_MAX) {
+        std::vector<size_t> delivered(simulation.m_orders.size(), 0);
+
+        for (uint32_t drone = 0; m_supported && drone < plan.drone_count(); ++drone) {
+            Trip* trip = nullptr;
+            for (auto& command: plan.drone(drone)) {
+                switch (command.type) {
+                    case WAIT:
+                        break;
+                    case LOAD:
+                        if (!trip || !trip->stops.empty() || trip->warehouse != command.target) {
+                            m_trips.push_back(Trip());
+                            trip = &m_trips.back();
+                            trip->warehouse = command.target;
+                            trip->weight = 0;
+
+                            Slot slot = { drone, uint32_t(m_drones[drone].size()) };
+                            m_slots.push_back(slot);
+                            m_drones[drone].push_back(m_trips.size() - 1);
+                        }
+                        add_entry(trip->loads, command.product, command.count);
+                        trip->weight += simulation.m_products[command.product].weight * command.count;
+                        break;
+                    case DELIVER:
+                        if (!trip) {
+                            m_supported = false;
+                            break;
+                        }
+                        if (trip->stops.empty() || trip->stops.back().order != command.target) {
+                            // Coming back to an order in the same trip, or
+                            // too many stops.
+                            if (trip->stop_for(command.target) || trip->stops.size() == MAX_STOPS) {
+                                m_supported = false;
+                                break;
+                            }
+                            Stop stop;
+                            stop.order = command.target;
+                            trip->stops.push_back(stop);
+                        }
+                        add_entry(trip->stops.back().items, command.product, command.count);
+                        delivered[command.target] += command.count;
+                        break;
+                    default:
+                        m_supported = false;
+                }
+                if (!m_supported)
+                    break;
+            }
+
+            // Every trip needs to drop what it loads, and nothing else.
+            if (trip && trip->stops.empty())
+                m_supported = false;
+        }
+
+        for (auto& trip: m_trips) {
+            std::vector<Entry> dropped;
+            for (auto& stop: trip.stops)
+                dropped.insert(dropped.end(), stop.items.begin(), stop.items.end());
+            if (totals(trip.loads) != totals(dropped))
+                m_supported = false;
+        }
+
+        if (!m_supported)
+            return;
+
+        m_timings.resize(m_trips.size());
+        for (uint32_t i = 0; i < m_trips.size(); ++i) {
+            measure(i);
+            m_warehouse_trips[m_trips[i].warehouse].push_back(i);
+        }
+
+        for (auto& order: simulation.m_orders) {
+            m_order_states[order.id].score = 0;
+            m_order_states[order.id].last_turn = 0;
+            m_order_states[order.id].last_trip = UINT32_MAX;
+            m_order_states[order.id].complete = delivered[order.id] == order.item_count();
+        }
+
+        retime_all();
+    }
+
+    // Whether the plan could be turned into trips. It can't if it has unloads,
+    // trips that keep stuff in the drone, or too many stops.
+    bool supported() const {
+        return m_supported;
+    }
+
+    size_t score() const {
+        return m_score;
+    }
+
+    // Runs for `seconds`, and leaves the best plan found in place.
+    //
+    // Moves are accepted if they don't make the plan worse than it was, or
+    // than it was `history` moves ago. With a history of one that's plain
+    // hill climbing, which on the inputs we have does better than longer
+    // histories for budgets of up to a minute or so.
+    Stats run(double seconds, size_t history_length = 1, uint64_t seed = 42) {
+        typedef std::chrono::steady_clock Clock;
+        Stats stats;
+        stats.initial_score = stats.best_score = m_score;
+        if (!m_supported || m_trips.size() < 2)
+            return stats;
+
+        history_length = std::max<size_t>(history_length, 1);
+        std::vector<size_t> history(history_length, m_score);
+
+        std::mt19937_64 random(seed);
+        auto start = Clock::now();
+        auto deadline = start + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(seconds));
+
+        // The best plan is saved lazily, right before the search leaves it
+        // for a worse one.
+        std::vector<Trip> best_trips;
+        std::vector<Timing> best_timings;
+        std::vector<Slot> best_slots;
+        std::vector<std::vector<uint32_t>> best_drones;
+        bool at_best = true;
+
+        Move move;
+        Backup backup;
+        while (true) {
+            if ((stats.iterations & 1023) == 0 && Clock::now() >= deadline)
+                break;
+            stats.iterations++;
+
+            if (!random_move(random, move))
+                continue;
+
+            size_t previous = m_score;
+            bool feasible = apply(move, backup);
+            size_t slot = stats.iterations % history_length;
+            if (!feasible || (m_score < history[slot] && m_score < previous)) {
+                undo(move, backup);
+                assert(m_score == previous);
+                continue;
+            }
+
+            stats.accepted++;
+            if (m_score < stats.best_score && at_best) {
+                // Undoing a relocation leaves its target in the move, so it
+                // can be applied again.
+                undo(move, backup);
+                best_trips = m_trips;
+                best_timings = m_timings;
+                best_slots = m_slots;
+                best_drones = m_drones;
+                apply(move, backup);
+            }
+
+            if (m_score > stats.best_score) {
+                stats.best_score = m_score;
+                stats.improvements++;
+            }
+            at_best = m_score == stats.best_score;
+            history[slot] = m_score;
+        }
+
+        if (!at_best) {
+            m_trips.swap(best_trips);
+            m_timings.swap(best_timings);
+            m_slots.swap(best_slots);
+            m_drones.swap(best_drones);
+            retime_all();
+        }
+        assert(m_score == stats.best_score);
+
+        stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        return stats;
+    }
+
+    // The commands for the current trips, loads first, then the deliveries
+    // stop by stop.
+    Plan plan() const {
+        Plan plan(m_drones.size());
+        for (uint32_t drone = 0; drone < m_drones.size(); ++drone) {
+            for (auto id: m_drones[drone]) {
+                const Trip& trip = m_trips[id];
+                for (auto& load: trip.loads)
+                    plan.add(Command::load(drone, trip.warehouse, load.first, load.second));
+                for (auto& stop: trip.stops) {
+                    for (auto& item: stop.items)
+                        plan.add(Command::deliver(drone, stop.order, item.first, item.second));
+                }
+            }
+        }
+        return plan;
+    }
+};
+
+#endif
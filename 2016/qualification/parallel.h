@@ -0,0 +1,124 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+#include <cassert>
+
+// Threads that stay around to run parallel_for() as many times as needed,
+// instead of starting new ones every time: the planner runs one per busy
+// turn, which would be thousands of thread starts for a single input.
+//
+// The calling thread works too, so a pool of `threads` starts `threads - 1`.
+// Only one parallel_for() runs at a time, and tasks can't start another.
+class ThreadPool {
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_started;
+    std::condition_variable m_finished;
+
+    // The current job, set under the lock before bumping the generation.
+    const std::function<void(size_t)>* m_task;
+    size_t m_count;
+    std::atomic<size_t> m_next;
+    size_t m_generation;
+    // Workers that haven't run out of tasks of the current job yet.
+    size_t m_busy;
+    bool m_stopping;
+
+    // Tasks are handed out one at a time, so slow ones don't hold the rest
+    // back.
+    void work() {
+        while (true) {
+            size_t i = m_next++;
+            if (i >= m_count)
+                break;
+            (*m_task)(i);
+        }
+    }
+
+    void worker() {
+        size_t generation = 0;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            m_started.wait(lock, [&]() {
+                return m_stopping || m_generation != generation;
+            });
+            if (m_stopping)
+                return;
+            generation = m_generation;
+
+            lock.unlock();
+            work();
+            lock.lock();
+            if (--m_busy == 0)
+                m_finished.notify_one();
+        }
+    }
+
+public:
+    explicit ThreadPool(size_t threads)
+        : m_task(nullptr), m_count(0), m_next(0)
+        , m_generation(0), m_busy(0), m_stopping(false) {
+        for (size_t i = 1; i < threads; ++i)
+            m_workers.push_back(std::thread(&ThreadPool::worker, this));
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_started.notify_all();
+        for (auto& thread: m_workers)
+            thread.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const {
+        return m_workers.size() + 1;
+    }
+
+    // Runs `task(0) ... task(count - 1)` and returns once they're all done.
+    // Which thread runs which is up to scheduling, so tasks should write
+    // their results to their own slot, for the caller to go through in
+    // order.
+    void parallel_for(size_t count, const std::function<void(size_t)>& task) {
+        if (m_workers.empty() || count <= 1) {
+            for (size_t i = 0; i < count; ++i)
+                task(i);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            assert(!m_task);
+            m_task = &task;
+            m_count = count;
+            m_next = 0;
+            m_busy = m_workers.size();
+            m_generation++;
+        }
+        m_started.notify_all();
+        work();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_finished.wait(lock, [this]() { return m_busy == 0; });
+        m_task = nullptr;
+    }
+};
+
+inline size_t default_thread_count() {
+    return std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Something wrong with an input file, with where it happened.
+class ParseError : public std::runtime_error {
+public:
+    size_t m_offset;
+
+    explicit ParseError(const std::string& message, size_t offset)
+        : std::runtime_error(message), m_offset(offset) {}
+};
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+    const char* m_data;
+    size_t m_size;
+
+public:
+    explicit MappedFile(const char* path): m_data(nullptr), m_size(0) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            throw ParseError(std::string(path) + ": " + strerror(errno), 0);
+
+        struct stat info;
+        if (fstat(fd, &info) < 0) {
+            close(fd);
+            throw ParseError(std::string(path) + ": " + strerror(errno), 0);
+        }
+
+        m_size = static_cast<size_t>(info.st_size);
+        if (m_size) {
+            void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                close(fd);
+                throw ParseError(std::string(path) + ": " + strerror(errno), 0);
+            }
+            madvise(data, m_size, MADV_SEQUENTIAL);
+            m_data = static_cast<const char*>(data);
+        }
+        close(fd);
+    }
+
+    ~MappedFile() {
+        if (m_data)
+            munmap(const_cast<char*>(m_data), m_size);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+};
+
+// Scanner for the input files, which are just whitespace separated unsigned
+// integers. No locales, no streams, and no allocations.
+//
+// Errors are thrown as ParseErrors saying what we expected, and where.
+class InputParser {
+    const char* m_path;
+    MappedFile m_file;
+    const char* m_cursor;
+    const char* m_end;
+
+    void skip_whitespace() {
+        while (m_cursor < m_end &&
+               (*m_cursor == ' ' || *m_cursor == '\n' || *m_cursor == '\r' || *m_cursor == '\t'))
+            ++m_cursor;
+    }
+
+public:
+    explicit InputParser(const char* path)
+        : m_path(path)
+        , m_file(path)
+        , m_cursor(m_file.data())
+        , m_end(m_file.data() + m_file.size()) {}
+
+    size_t offset() const {
+        return m_cursor - m_file.data();
+    }
+
+    size_t size() const {
+        return m_file.size();
+    }
+
+    void fail(const std::string& message, size_t offset) const {
+        size_t line = 1 + std::count(m_file.data(), m_file.data() + offset, '\n');
+        throw ParseError(std::string(m_path) + ":" + std::to_string(line) +
+                         " (byte " + std::to_string(offset) + "): " + message, offset);
+    }
+
+    // Reads the next number, which should be `what`.
+    size_t number(const char* what) {
+        skip_whitespace();
+        if (m_cursor == m_end)
+            fail(std::string("expected ") + what + ", found end of file", offset());
+        if (*m_cursor < '0' || *m_cursor > '9')
+            fail(std::string("expected ") + what + ", found '" + *m_cursor + "'", offset());
+
+        size_t start = offset();
+        uint64_t value = 0;
+        while (m_cursor < m_end && *m_cursor >= '0' && *m_cursor <= '9') {
+            uint64_t next = value * 10 + (*m_cursor - '0');
+            if (next / 10 != value)
+                fail(std::string(what) + " is too big", start);
+            value = next;
+            ++m_cursor;
+        }
+        return value;
+    }
+
+    // Same, but checking it's below `limit`.
+    size_t number_below(const char* what, size_t limit) {
+        skip_whitespace();
+        size_t start = offset();
+        size_t value = number(what);
+        if (value >= limit) {
+            fail(std::string(what) + " " + std::to_string(value) +
+                 " out of range (must be < " + std::to_string(limit) + ")", start);
+        }
+        return value;
+    }
+
+    void expect_end() {
+        skip_whitespace();
+        if (m_cursor != m_end)
+            fail("trailing garbage", offset());
+    }
+};
+
+#endif
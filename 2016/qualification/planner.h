@@ -0,0 +1,793 @@
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <queue>
+#include <memory>
+#include <functional>
+#include <algorithm>
+
+#include <cassert>
+#include <cstdint>
+
+#include "commands.h"
+#include "simulation.h"
+#include "instrumentation.h"
+#include "rebalancer.h"
+#include "ledger.h"
+#include "parallel.h"
+
+// Min-heap of the turns at which busy drones become available again, so the
+// main loop can jump straight to the next turn where something can happen
+// instead of walking all of them up to the deadline.
+class DroneEvents {
+    typedef std::pair<size_t, DroneId> Event;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> m_heap;
+
+public:
+    void push(size_t turn, DroneId id) {
+        m_heap.push(Event(turn, id));
+    }
+
+    bool empty() const {
+        return m_heap.empty();
+    }
+
+    size_t next_turn() const {
+        assert(!empty());
+        return m_heap.top().first;
+    }
+
+    // Pops every drone that is available at `turn`, and returns how many
+    // were.
+    size_t release(size_t turn) {
+        size_t released = 0;
+        while (!m_heap.empty() && m_heap.top().first <= turn) {
+            m_heap.pop();
+            released++;
+        }
+        return released;
+    }
+};
+
+// The knobs of the greedy. The default one is the original planner.
+struct Strategy {
+    enum OrderKey {
+        BY_ID,
+        BY_WEIGHT,
+        BY_ITEM_COUNT,
+        BY_DISTANCE,
+    };
+
+    // In which order the orders get a chance to grab a drone every turn.
+    OrderKey order_key;
+
+    // Which drone to pick when several are equally near. Drones are all
+    // alike and start at the same place, so this mostly just renames them,
+    // and all() leaves it alone.
+    bool prefer_greatest_drone_id;
+
+    // When filling a drone, whether to skip products the warehouse lacks or
+    // that don't fit, instead of taking off with what we have.
+    bool skip_misses;
+
+    // Whether to fill the room left in the drone with other orders near the
+    // route, see Planner::pack_orders().
+    bool pack_orders;
+
+    // Whether idle drones move stock to the warehouses that will need it, see
+    // rebalancer.h.
+    bool rebalance;
+
+    Strategy()
+        : order_key(BY_ID)
+        , prefer_greatest_drone_id(true)
+        , skip_misses(false)
+        , pack_orders(false)
+        , rebalance(false) {}
+
+    std::string name() const {
+        static const char* KEYS[] = { "id", "weight", "items", "distance" };
+        return std::string(KEYS[order_key]) +
+               (prefer_greatest_drone_id ? "" : "/first-drone") +
+               (skip_misses ? "/skip" : "/stop") +
+               (pack_orders ? "/pack" : "") +
+               (rebalance ? "/rebalance" : "");
+    }
+
+    static std::vector<Strategy> all() {
+        std::vector<Strategy> strategies;
+        for (int key = BY_ID; key <= BY_DISTANCE; ++key) {
+            for (int skip = 0; skip <= 1; ++skip) {
+                for (int pack = 0; pack <= 1; ++pack) {
+                    for (int rebalance = 0; rebalance <= 1; ++rebalance) {
+                        Strategy strategy;
+                        strategy.order_key = static_cast<OrderKey>(key);
+                        strategy.skip_misses = skip;
+                        strategy.pack_orders = pack;
+                        strategy.rebalance = rebalance;
+                        strategies.push_back(strategy);
+                    }
+                }
+            }
+        }
+        return strategies;
+    }
+};
+
+// How full the drones flew, and how far.
+struct TripStats {
+    size_t trips;
+    size_t items;
+    size_t weight;
+    size_t capacity;
+
+    // Turns spent flying on delivery trips, and the orders they completed.
+    size_t flight;
+    size_t completed_orders;
+
+    // Trips moving stock between warehouses, which don't count as trips
+    // above.
+    size_t rebalancing_trips;
+    size_t rebalanced_items;
+
+    TripStats()
+        : trips(0), items(0), weight(0), capacity(0)
+        , flight(0), completed_orders(0)
+        , rebalancing_trips(0), rebalanced_items(0) {}
+
+    // Carried weight over what the drones could have carried.
+    double load_factor() const {
+        return capacity ? double(weight) / double(capacity) : 0;
+    }
+
+    double items_per_trip() const {
+        return trips ? double(items) / double(trips) : 0;
+    }
+
+    double flight_per_order() const {
+        return completed_orders ? double(flight) / double(completed_orders) : 0;
+    }
+
+    void print(std::ostream& out) const {
+        out << "trips: " << trips << ", " << items_per_trip() << " items per trip, "
+            << "load factor " << load_factor() << std::endl;
+        out << "flight: " << flight_per_order() << " turns per completed order" << std::endl;
+        if (rebalancing_trips) {
+            out << "rebalancing: " << rebalancing_trips << " trips, "
+                << rebalanced_items << " items" << std::endl;
+        }
+    }
+};
+
+// The greedy: every turn, each pending order in turn grabs the nearest idle
+// drone to the nearest warehouse that has its next product, which loads as
+// much of the order as it can from there and delivers it. Optionally, the drone
+// also takes whole orders near its route with the room it has left.
+//
+// Works on (and consumes) the simulation it's given, adding the commands to
+// `out`.
+//
+// With more than one thread, turns where lots of drones are idle get planned
+// in batches: the threads work out a trip for each order of the batch against
+// the same state, reserving their stock and drone in a ReservationLedger, and
+// then the trips get applied in order. A trip that lost a race, or that some
+// earlier order needs the stock or the drone of, is planned again right then,
+// so the plan is the same one a single thread makes, whatever the number of
+// threads and however they interleave.
+class Planner {
+    // A trip for one order: fly `drone` to `warehouse`, load `items` (indices
+    // into the order) in that order, and deliver them. `loads` is how many
+    // units of each product that is.
+    struct Proposal {
+        OrderId order;
+        WarehouseId warehouse;
+        DroneId drone;
+        std::vector<uint32_t> items;
+        std::vector<std::pair<ProductId, uint32_t>> loads;
+        size_t weight;
+
+        Proposal(): order(INVALID), warehouse(INVALID), drone(INVALID), weight(0) {}
+    };
+
+    enum Outcome {
+        PLANNED,
+        UNPLANNED,
+        // No idle drone can deliver even a single item by the deadline. One
+        // may land nearer later, but with less time left, and a part of an
+        // order is worth nothing, so we give up on it rather than asking
+        // again every turn until the end.
+        TOO_LATE,
+    };
+
+    Simulation& m_simulation;
+    Strategy m_strategy;
+    Plan& m_out;
+    ProgressReporter* m_progress;
+    TripStats m_stats;
+    std::unique_ptr<ThreadPool> m_pool;
+
+    // What run() keeps track of from turn to turn.
+    DroneEvents m_events;
+    size_t m_idle_drones;
+    size_t m_pending_orders;
+    std::unique_ptr<Rebalancer> m_rebalancer;
+    std::unique_ptr<ReservationLedger> m_ledger;
+
+    // Orders that can't be delivered anymore, and nobody plans for.
+    std::vector<bool> m_abandoned;
+
+    // Most orders a single trip serves when packing.
+    static const size_t MAX_STOPS = 4;
+
+    // At most one drone in this many moves stock at a time, and only when
+    // the transfer saves this many times the turns it takes.
+    static const size_t MAX_REBALANCING_SHARE = 8;
+    static const size_t MIN_REBALANCING_GAIN = 2;
+
+    // Fewer orders than this get planned on a single thread, since starting
+    // the threads would take longer.
+    static const size_t MIN_PARALLEL_BATCH = 64;
+
+    // Whether the warehouse has everything the order is still missing.
+    bool can_serve(const Warehouse& warehouse, const Order& order) const {
+        for (size_t i = order.next_undelivered_item(); i < order.item_count(); ++i) {
+            ProductId product = order.product(i);
+            if (!order.delivered(i) && !warehouse.has(product, order.remaining(product)))
+                return false;
+        }
+        return true;
+    }
+
+    // Works out the trip for the order, without changing anything: the
+    // nearest idle drone to the nearest warehouse with the order's next
+    // product, filled with as much of the order as the warehouse has and the
+    // drone can carry, and deliver by the deadline.
+    //
+    // Only `counted` queries go into the instrumentation, which the planning
+    // threads can't touch. With an `owner`, it's a thread planning a batch:
+    // the drone is the nearest one nobody else in the batch has claimed, and
+    // it gets claimed for `owner`. It may not be the one that flies, so the
+    // trip takes as many items as if there was no deadline, and gets trimmed
+    // once we know.
+    Outcome propose(const Order& order, Proposal& proposal, bool counted,
+                    uint32_t owner = INVALID) const {
+        const Simulation& simulation = m_simulation;
+        ProductId first = order.next_undelivered_product();
+        if (first == INVALID)
+            return UNPLANNED;
+
+        // It can all be on its way to another warehouse.
+        if (simulation.m_inventory.holders(first).empty())
+            return UNPLANNED;
+
+        WarehouseId warehouse_id = counted
+            ? m_simulation.nearest_warehouse_with_product(order, first).id
+            : simulation.find_warehouse_with_product(order, first);
+        const Warehouse& warehouse = simulation.m_warehouses[warehouse_id];
+
+        // A turn to load and a turn to deliver each item.
+        size_t leg = simulation.m_distances->warehouse_to_order(warehouse_id, order.id);
+        if (simulation.m_current_turn + leg + 2 > simulation.m_turns_deadline)
+            return TOO_LATE;
+
+        // Drones further than this won't make it, and not looking at them
+        // saves a lot near the end.
+        size_t reach = simulation.m_turns_deadline - simulation.m_current_turn - leg - 2;
+        DroneId drone_id;
+        if (owner != INVALID) {
+            const ReservationLedger& ledger = *m_ledger;
+            do {
+                drone_id = simulation.m_drone_index.nearest(warehouse.position, [&](DroneId id) {
+                    return simulation.m_drones[id].unbusy(simulation.m_current_turn) && ledger.owner(id) == INVALID;
+                }, m_strategy.prefer_greatest_drone_id, reach);
+            } while (drone_id != INVALID && !m_ledger->try_claim(drone_id, owner));
+        } else if (counted) {
+            drone_id = m_simulation.nearest_unbusy_drone(warehouse.position, m_strategy.prefer_greatest_drone_id, reach);
+        } else {
+            drone_id = simulation.find_unbusy_drone(warehouse.position, m_strategy.prefer_greatest_drone_id, reach);
+        }
+        if (drone_id == INVALID)
+            return TOO_LATE;
+
+        const size_t max_items = owner != INVALID ? SIZE_MAX : items_in_time(warehouse_id, drone_id, order);
+
+        proposal = Proposal();
+        proposal.order = order.id;
+        proposal.warehouse = warehouse_id;
+        proposal.drone = drone_id;
+
+        // Whether one more of the item fits, is left, counting what the trip
+        // has taken already, and gets there in time. Loads are few, so a scan
+        // does.
+        auto fits = [&](size_t item) {
+            ProductId product = order.product(item);
+            if (proposal.items.size() == max_items)
+                return false;
+            if (proposal.weight + simulation.m_products[product].weight > simulation.m_drone_max_load)
+                return false;
+            size_t taken = 0;
+            for (auto& load: proposal.loads) {
+                if (load.first == product)
+                    taken = load.second;
+            }
+            return warehouse.has(product, taken + 1);
+        };
+
+        auto take = [&](size_t item) {
+            ProductId product = order.product(item);
+            proposal.items.push_back(static_cast<uint32_t>(item));
+            proposal.weight += simulation.m_products[product].weight;
+            for (auto& load: proposal.loads) {
+                if (load.first == product) {
+                    load.second++;
+                    return;
+                }
+            }
+            proposal.loads.push_back(std::make_pair(product, 1u));
+        };
+
+        // The first item always goes, even if it's too heavy on its own.
+        size_t cursor = order.next_undelivered_item();
+        take(cursor);
+        for (size_t i = cursor + 1; i < order.item_count(); ++i) {
+            if (order.delivered(i))
+                continue;
+            if (!fits(i)) {
+                if (m_strategy.skip_misses)
+                    continue;
+                break;
+            }
+            take(i);
+        }
+        return PLANNED;
+    }
+
+    // How many items the drone can deliver to the order by the deadline, going
+    // through the warehouse.
+    size_t items_in_time(WarehouseId warehouse, DroneId drone, const Order& order) const {
+        const Simulation& simulation = m_simulation;
+        size_t flight = simulation.m_drones[drone].position.distance(simulation.m_warehouses[warehouse].position) +
+                        simulation.m_distances->warehouse_to_order(warehouse, order.id);
+        assert(simulation.m_current_turn + flight <= simulation.m_turns_deadline);
+        return (simulation.m_turns_deadline - simulation.m_current_turn - flight) / 2;
+    }
+
+    // Drops the last items of the trip until there are at most `max_items`.
+    // Whatever the strategy, that's the trip we'd have planned with that
+    // many at most: the items before are picked the same way.
+    void trim(Proposal& proposal, size_t max_items) const {
+        while (proposal.items.size() > max_items) {
+            ProductId product = m_simulation.m_orders[proposal.order].product(proposal.items.back());
+            proposal.items.pop_back();
+            proposal.weight -= m_simulation.m_products[product].weight;
+            for (size_t i = 0; i < proposal.loads.size(); ++i) {
+                if (proposal.loads[i].first != product)
+                    continue;
+                if (!--proposal.loads[i].second)
+                    proposal.loads.erase(proposal.loads.begin() + i);
+                break;
+            }
+        }
+    }
+
+    // Plans the order on its own, as in a batch of one.
+    void plan(size_t turn, OrderId order_id) {
+        Proposal proposal;
+        Outcome outcome = propose(m_simulation.m_orders[order_id], proposal, true);
+        if (outcome == PLANNED)
+            commit(turn, proposal);
+        else if (outcome == TOO_LATE)
+            abandon(order_id);
+    }
+
+    void abandon(OrderId order_id) {
+        m_abandoned[order_id] = true;
+        m_pending_orders--;
+    }
+
+    // Flies the proposed trip, packing other orders into it if the strategy
+    // says so.
+    void commit(size_t turn, const Proposal& proposal) {
+        Simulation& simulation = m_simulation;
+        Order& order = simulation.m_orders[proposal.order];
+        Warehouse& warehouse = simulation.m_warehouses[proposal.warehouse];
+        DroneId drone_id = proposal.drone;
+        Drone& drone = simulation.m_drones[drone_id];
+
+        size_t delta = drone.position.distance(warehouse.position) +
+                       simulation.m_distances->warehouse_to_order(warehouse.id, order.id);
+
+        std::vector<ProductId> to_deliver;
+        for (auto item: proposal.items) {
+            ProductId product = order.product(item);
+            order.mark_item_as_delivered(item);
+            warehouse.take(product);
+            m_out.add(Command::load(drone_id, warehouse.id, product, 1));
+            delta += 1;
+            to_deliver.push_back(product);
+        }
+
+        size_t weight = proposal.weight;
+        std::vector<OrderId> route(1, order.id);
+        std::vector<std::vector<ProductId>> drops(1, std::move(to_deliver));
+        if (m_strategy.pack_orders)
+            delta += pack_orders(drone_id, warehouse, weight, turn + delta + drops[0].size(), route, drops);
+
+        size_t trip_items = 0;
+        for (size_t stop = 0; stop < route.size(); ++stop) {
+            auto& served = simulation.m_orders[route[stop]];
+            for (auto id: drops[stop]) {
+                delta += 1;
+                m_out.add(Command::deliver(drone_id, served.id, id, 1));
+                if (m_rebalancer)
+                    m_rebalancer->delivered(served.id, id);
+            }
+
+            trip_items += drops[stop].size();
+            if (served.complete()) {
+                m_pending_orders--;
+                m_stats.completed_orders++;
+                simulation.retire_order(served.id);
+            }
+        }
+
+        // A turn to load and a turn to deliver each item, and the rest is
+        // flying.
+        m_stats.items += trip_items;
+        m_stats.flight += delta - 2 * trip_items;
+        m_stats.trips++;
+        m_stats.weight += weight;
+        m_stats.capacity += simulation.m_drone_max_load;
+
+        drone.expected_unbusy_turn = turn + delta;
+        simulation.move_drone(drone_id, simulation.m_orders[route.back()].destination);
+        m_events.push(drone.expected_unbusy_turn, drone_id);
+        m_idle_drones--;
+    }
+
+    // Reserves the stock of the trip, whose drone `owner` has claimed
+    // already. All or nothing: if some isn't there, the drone goes too.
+    bool reserve(const Proposal& proposal, uint32_t owner) {
+        ReservationLedger& ledger = *m_ledger;
+        for (size_t i = 0; i < proposal.loads.size(); ++i) {
+            auto& load = proposal.loads[i];
+            if (!ledger.try_reserve(proposal.warehouse, load.first, load.second)) {
+                while (i--)
+                    ledger.release(proposal.warehouse, proposal.loads[i].first, proposal.loads[i].second);
+                ledger.release_drone(proposal.drone, owner);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void release(const Proposal& proposal, uint32_t owner) {
+        for (auto& load: proposal.loads)
+            m_ledger->release(proposal.warehouse, load.first, load.second);
+        m_ledger->release_drone(proposal.drone, owner);
+    }
+
+    // Plans the orders of `batch`, which are at most as many as the idle
+    // drones, as if one by one. Each order's index in the batch is its owner
+    // id in the ledger.
+    void plan_batch(size_t turn, const std::vector<OrderId>& batch) {
+        Simulation& simulation = m_simulation;
+        Instrumentation& instrumentation = simulation.m_instrumentation;
+
+        // First everybody plans against the state at the start of the batch,
+        // with the nearest drone nobody has claimed yet, and keeps the trip if
+        // the stock is there too.
+        std::vector<Proposal> proposals(batch.size());
+        std::unique_ptr<bool[]> reserved(new bool[batch.size()]);
+        m_pool->parallel_for(batch.size(), [&](size_t i) {
+            const Order& order = simulation.m_orders[batch[i]];
+            reserved[i] = propose(order, proposals[i], false, i) == PLANNED && reserve(proposals[i], i);
+        });
+
+        auto revoke = [&](size_t j) {
+            assert(reserved[j]);
+            release(proposals[j], j);
+            reserved[j] = false;
+        };
+
+        // Then the trips get applied in order. The warehouse and the items of
+        // a trip that holds its reservation are what planning it now would
+        // pick: the stock only goes down during the batch, and what it took
+        // is still there, so the warehouse is still the nearest, and whatever
+        // it left behind still isn't there. Its drone may not be the nearest
+        // idle one anymore, or may never have been, but there's nothing
+        // nearer than it to look at. Any other trip gets planned again,
+        // taking what it needs from the latest orders holding it, which plan
+        // again later.
+        for (size_t i = 0; i < batch.size(); ++i) {
+            const Order& order = simulation.m_orders[batch[i]];
+            Proposal& proposal = proposals[i];
+            Outcome outcome = PLANNED;
+            if (reserved[i]) {
+                instrumentation.count(Instrumentation::NEAREST_WAREHOUSE_QUERIES);
+                const Point& from = simulation.m_warehouses[proposal.warehouse].position;
+                size_t distance = simulation.m_drones[proposal.drone].position.distance(from);
+                DroneId nearest = simulation.nearest_unbusy_drone(from, m_strategy.prefer_greatest_drone_id, distance);
+                assert(nearest != INVALID);
+                revoke(i);
+                proposal.drone = nearest;
+                trim(proposal, items_in_time(proposal.warehouse, nearest, order));
+            } else {
+                outcome = propose(order, proposal, true);
+            }
+            if (outcome == TOO_LATE)
+                abandon(batch[i]);
+            if (outcome != PLANNED)
+                continue;
+
+            uint32_t owner = m_ledger->owner(proposal.drone);
+            if (owner != INVALID) {
+                assert(owner > i);
+                revoke(owner);
+            }
+            for (auto& load: proposal.loads) {
+                for (size_t j = batch.size(); m_ledger->available(proposal.warehouse, load.first) < load.second;) {
+                    assert(j > i + 1);
+                    --j;
+                    if (!reserved[j] || proposals[j].warehouse != proposal.warehouse)
+                        continue;
+                    for (auto& other: proposals[j].loads) {
+                        if (other.first == load.first) {
+                            revoke(j);
+                            break;
+                        }
+                    }
+                }
+            }
+            commit(turn, proposal);
+        }
+    }
+
+    // Packing: while there's room in the drone, take the nearest pending
+    // order to the last stop that fits whole and that the warehouse can
+    // serve on its own. Only orders no further than the leg from the
+    // warehouse to the first stop are considered, so detours stay shorter
+    // than a trip of their own would be.
+    //
+    // Loads everything, appending the stops to `route` and their items to
+    // `drops`, updates the drone's `weight`, and returns the turns the loads
+    // and the detours add to the trip, which would otherwise end at
+    // `trip_end`.
+    size_t pack_orders(DroneId drone_id, Warehouse& warehouse, size_t& weight,
+                       size_t trip_end,
+                       std::vector<OrderId>& route,
+                       std::vector<std::vector<ProductId>>& drops) {
+        Simulation& simulation = m_simulation;
+        const Order& first = simulation.m_orders[route.front()];
+        const size_t radius = simulation.m_distances->warehouse_to_order(warehouse.id, first.id);
+
+        size_t added = 0;
+        Point last = first.destination;
+        while (route.size() < MAX_STOPS && weight < simulation.m_drone_max_load) {
+            size_t room = simulation.m_drone_max_load - weight;
+            OrderId next = simulation.nearest_pending_order(last, radius, [&](OrderId id) {
+                const Order& candidate = simulation.m_orders[id];
+                return !candidate.complete() &&
+                       candidate.remaining_weight() <= room &&
+                       std::find(route.begin(), route.end(), id) == route.end() &&
+                       can_serve(warehouse, candidate);
+            });
+            if (next == INVALID)
+                break;
+
+            Order& order = simulation.m_orders[next];
+            // Flying there and loading; delivering is up to the caller, but
+            // it has to fit before the deadline too.
+            size_t items = order.remaining_items();
+            size_t cost = last.distance(order.destination) + items;
+            if (trip_end + added + cost + items > simulation.m_turns_deadline)
+                break;
+            weight += order.remaining_weight();
+
+            std::vector<ProductId> drop;
+            for (size_t i = order.next_undelivered_item(); i < order.item_count(); ++i) {
+                if (order.delivered(i))
+                    continue;
+                ProductId product = order.product(i);
+                order.mark_item_as_delivered(i);
+                warehouse.take(product);
+                m_out.add(Command::load(drone_id, warehouse.id, product, 1));
+                drop.push_back(product);
+            }
+
+            added += cost;
+            last = order.destination;
+            route.push_back(next);
+            drops.push_back(std::move(drop));
+        }
+        return added;
+    }
+
+    // Sends idle drones to move stock while there's some worth moving and
+    // not too many of them are at it already. Returns how many went.
+    size_t rebalance(Rebalancer& rebalancer, size_t turn, size_t idle_drones,
+                     std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>>& rebalancing,
+                     DroneEvents& events) {
+        Simulation& simulation = m_simulation;
+        const size_t max_rebalancing = std::max<size_t>(1, simulation.m_drones.size() / MAX_REBALANCING_SHARE);
+
+        size_t sent = 0;
+        Rebalancer::Transfer transfer;
+        while (sent < idle_drones && rebalancing.size() < max_rebalancing &&
+               rebalancer.best_transfer(simulation.m_drone_max_load, transfer)) {
+            const Warehouse& from = simulation.m_warehouses[transfer.from];
+            DroneId drone_id = simulation.nearest_unbusy_drone(from.position, m_strategy.prefer_greatest_drone_id);
+            if (drone_id == INVALID)
+                break;
+
+            Drone& drone = simulation.m_drones[drone_id];
+            size_t turns = drone.position.distance(from.position) +
+                           simulation.m_distances->warehouse_to_warehouse(transfer.from, transfer.to) +
+                           2 * transfer.items.size();
+            if (transfer.gain < MIN_REBALANCING_GAIN * turns || turn + turns > simulation.m_turns_deadline)
+                break;
+
+            turns = rebalancer.dispatch(drone_id, drone.position, transfer, turn, m_out);
+            m_stats.rebalancing_trips++;
+            m_stats.rebalanced_items += transfer.item_count();
+            simulation.m_instrumentation.count(Instrumentation::REBALANCING_TRIPS);
+            simulation.m_instrumentation.count(Instrumentation::REBALANCED_ITEMS, transfer.item_count());
+
+            drone.expected_unbusy_turn = turn + turns;
+            simulation.move_drone(drone_id, simulation.m_warehouses[transfer.to].position);
+            events.push(drone.expected_unbusy_turn, drone_id);
+            rebalancing.push(drone.expected_unbusy_turn);
+            sent++;
+        }
+        return sent;
+    }
+
+    std::vector<OrderId> order_sequence() const {
+        std::vector<OrderId> sequence;
+        std::vector<size_t> keys;
+        for (auto& order: m_simulation.m_orders) {
+            sequence.push_back(order.id);
+
+            size_t key = 0;
+            switch (m_strategy.order_key) {
+                case Strategy::BY_ID:
+                    break;
+                case Strategy::BY_WEIGHT:
+                    key = order.remaining_weight();
+                    break;
+                case Strategy::BY_ITEM_COUNT:
+                    key = order.item_count();
+                    break;
+                case Strategy::BY_DISTANCE:
+                    key = INVALID;
+                    for (auto& warehouse: m_simulation.m_warehouses)
+                        key = std::min(key, m_simulation.m_distances->warehouse_to_order(warehouse.id, order.id));
+                    break;
+            }
+            keys.push_back(key);
+        }
+
+        std::stable_sort(sequence.begin(), sequence.end(), [&keys](OrderId a, OrderId b) {
+            return keys[a] < keys[b];
+        });
+        return sequence;
+    }
+
+public:
+    explicit Planner(Simulation& simulation, const Strategy& strategy,
+                     Plan& out, ProgressReporter* progress = nullptr)
+        : m_simulation(simulation)
+        , m_strategy(strategy)
+        , m_out(out)
+        , m_progress(progress)
+        , m_idle_drones(0)
+        , m_pending_orders(0) {}
+
+    const TripStats& stats() const {
+        return m_stats;
+    }
+
+    // Threads to plan busy turns with, which stay around until the planner
+    // goes. Packing and rebalancing plan one order at a time whatever this
+    // says.
+    void set_threads(size_t threads) {
+        m_pool.reset(threads > 1 ? new ThreadPool(threads) : nullptr);
+    }
+
+    void run() {
+        Simulation& simulation = m_simulation;
+        Plan& out = m_out;
+        Instrumentation& instrumentation = simulation.m_instrumentation;
+        Instrumentation::Scope scope(instrumentation, Instrumentation::PLAN);
+        size_t initial_commands = out.count();
+        std::vector<OrderId> sequence = order_sequence();
+
+        m_abandoned.assign(simulation.m_orders.size(), false);
+        m_pending_orders = 0;
+        for (auto& order: simulation.m_orders) {
+            if (!order.complete())
+                m_pending_orders++;
+        }
+
+        if (m_strategy.rebalance)
+            m_rebalancer.reset(new Rebalancer(simulation));
+        // When each drone moving stock lands.
+        std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>> rebalancing;
+
+        bool parallel = m_pool && !m_strategy.pack_orders && !m_strategy.rebalance;
+        if (parallel) {
+            m_ledger.reset(new ReservationLedger(simulation.m_inventory, simulation.m_warehouses.size(),
+                                                 simulation.m_products.size(), simulation.m_drones.size()));
+        }
+
+        m_idle_drones = simulation.m_drones.size();
+        std::vector<OrderId> batch;
+        size_t turn = 0;
+        while (turn < simulation.m_turns_deadline) {
+            if (m_progress)
+                m_progress->update(turn, simulation.m_turns_deadline, m_pending_orders);
+            instrumentation.count(Instrumentation::TURNS_SIMULATED);
+            simulation.m_current_turn = turn;
+            m_idle_drones += m_events.release(turn);
+            size_t idle_at_start = m_idle_drones;
+
+            if (m_rebalancer) {
+                m_rebalancer->arrive(turn);
+                while (!rebalancing.empty() && rebalancing.top() <= turn)
+                    rebalancing.pop();
+                m_idle_drones -= rebalance(*m_rebalancer, turn, m_idle_drones, rebalancing, m_events);
+            }
+
+            // Every pending order gets a drone while there are any, so the
+            // ones that will are the next as many as there are idle drones,
+            // minus those that can't be served at all.
+            auto next = sequence.begin();
+            while (m_idle_drones && next != sequence.end()) {
+                batch.clear();
+                for (; next != sequence.end() && batch.size() < m_idle_drones; ++next) {
+                    if (!simulation.m_orders[*next].complete() && !m_abandoned[*next])
+                        batch.push_back(*next);
+                }
+
+                if (parallel && batch.size() >= MIN_PARALLEL_BATCH) {
+                    plan_batch(turn, batch);
+                    continue;
+                }
+
+                for (auto order_id: batch)
+                    plan(turn, order_id);
+            }
+
+            if (m_events.empty()) {
+                break; // ITS OVER!!
+            }
+
+            // If there are idle drones and work left they'll pick it up next
+            // turn, otherwise nothing can happen until some drone lands. Nor
+            // if none of them found anything to do this turn: the stock and
+            // the idle drones stay the same until then, and the deadline only
+            // gets nearer.
+            size_t next_turn = turn + 1;
+            if (!m_idle_drones || !m_pending_orders || m_idle_drones == idle_at_start)
+                next_turn = std::min(m_events.next_turn(), simulation.m_turns_deadline);
+            instrumentation.count(Instrumentation::TURNS_SKIPPED, next_turn - turn - 1);
+
+            // The idle set doesn't change in the turns we skip, so they just
+            // keep waiting.
+            for (; turn < next_turn; ++turn) {
+                for (auto& drone: simulation.m_drones) {
+                    if (drone.unbusy(turn)) {
+                        out.add(Command::wait(drone.id, 1));
+                    }
+                }
+            }
+        }
+
+        instrumentation.count(Instrumentation::COMMANDS_EMITTED, out.count() - initial_commands);
+    }
+};
+
+#endif
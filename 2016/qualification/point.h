@@ -0,0 +1,51 @@
+#ifndef POINT_H
+#define POINT_H
+
+#include <iostream>
+#include <cmath>
+#include <cstdint>
+
+// Ids are 32 bits: that's four billion of anything, and half the memory and
+// cache footprint of size_t in the per-item arrays.
+typedef uint32_t DroneId;
+typedef uint32_t WarehouseId;
+typedef uint32_t ProductId;
+typedef uint32_t OrderId;
+
+// No id, or no distance. Unsigned, so it also compares as greater than any
+// real distance.
+const uint32_t INVALID = UINT32_MAX;
+
+// The Hash Code distance: ceil(sqrt(dx^2 + dy^2)), computed exactly on
+// integers. The square root is only used as a first guess.
+inline size_t ceil_distance(size_t x1, size_t y1, size_t x2, size_t y2) {
+    uint64_t dx = x1 > x2 ? x1 - x2 : x2 - x1;
+    uint64_t dy = y1 > y2 ? y1 - y2 : y2 - y1;
+    uint64_t squared = dx * dx + dy * dy;
+
+    uint64_t root = static_cast<uint64_t>(sqrt(static_cast<double>(squared)));
+    while (root * root > squared)
+        root--;
+    while (root * root < squared)
+        root++;
+    return root;
+}
+
+class Point {
+public:
+    uint32_t x;
+    uint32_t y;
+
+    explicit Point(size_t x, size_t y): x(static_cast<uint32_t>(x)), y(static_cast<uint32_t>(y)) {}
+
+    size_t distance(const Point& other) const {
+        return ceil_distance(x, y, other.x, other.y);
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& out, const Point& point) {
+    out << "(" << point.x << ", " << point.y << ")";
+    return out;
+}
+
+#endif
@@ -2,380 +2,414 @@
 #include <fstream>
 #include <vector>
 #include <string>
-#include <sstream>
-#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
 
 #include <cassert>
-#include <cmath>
+#include <cstring>
+#include <cerrno>
+
+#include <glob.h>
 
 #include "commands.h"
 // Yes, I know this is awfully bad, but...
 #include "commands.cpp"
 
-typedef size_t DroneId;
-typedef size_t WarehouseId;
-typedef size_t ProductId;
-typedef size_t OrderId;
-
-const size_t INVALID = (size_t) -1;
-
-class Point {
-public:
-    size_t x;
-    size_t y;
-
-    explicit Point(size_t x, size_t y): x(x), y(y) {}
-
-    size_t distance(const Point& other) {
-        return static_cast<size_t>(ceil(sqrt(pow(x - other.x, 2) + pow(y - other.y, 2))));
+#include "simulation.h"
+#include "scorer.h"
+#include "planner.h"
+#include "parallel.h"
+#include "optimizer.h"
+#include "bench.h"
+#include "batch.h"
+#include "selftest.h"
+
+// Replays a command file (with or without the count header) and prints its
+// score.
+int score(const char* input, const char* commands) {
+    Simulation simulation(input);
+    simulation.print_summary(std::cout);
+    Scorer scorer(simulation);
+
+    ScoreReport report = scorer.score_file(commands);
+    if (!report.valid) {
+        std::cerr << commands << ": " << report.error << std::endl;
+        return 1;
     }
-};
 
-std::ostream& operator<<(std::ostream& out, const Point& point) {
-    out << "(" << point.x << ", " << point.y << ")";
-    return out;
+    std::cout << "score: " << report.score << std::endl;
+    std::cout << "completed orders: " << report.completed_orders << " / " << simulation.m_orders.size() << std::endl;
+    std::cout << "commands: " << report.commands << std::endl;
+    std::cout << "last turn: " << report.last_turn << " / " << simulation.m_turns_deadline << std::endl;
+    return 0;
 }
 
-class Warehouse {
-public:
-    WarehouseId id;
-    Point position;
-    std::unordered_map<ProductId, size_t> m_products_available;
-
-    void add_product(ProductId id, size_t available) {
-        m_products_available[id] = available;
-    }
-
-    bool has(ProductId id, size_t amount) {
-        return m_products_available[id] >= amount;
-    }
-
-    bool has(ProductId id) {
-        return has(id, 1);
-    }
+// Runs every planner strategy on its own copy of the simulation, scores them,
+// improves the best plan with local search, and writes it.
+//
+// With `seconds`, the whole run takes about that long: strategies only start
+// in the first half of it, so there's some left for the search, which runs
+// until the end. A strategy that already started still gets to finish, so a
+// large input can take longer. Without, every strategy runs and there's no
+// search.
+int best(const char* input, const char* output, size_t threads, double seconds) {
+    typedef std::chrono::steady_clock Clock;
+    auto start = Clock::now();
+    auto time_left = [&]() {
+        return seconds - std::chrono::duration<double>(Clock::now() - start).count();
+    };
+
+    const Simulation simulation(input);
+    simulation.print_summary(std::cout);
+    const Scorer scorer(simulation);
+    const std::vector<Strategy> strategies = Strategy::all();
+
+    std::mutex lock;
+    std::vector<ScoreReport> reports(strategies.size());
+    std::vector<TripStats> stats(strategies.size());
+    std::vector<bool> skipped(strategies.size(), false);
+    size_t best_index = INVALID;
+    Plan best_plan;
+    // Local search can't deal with unloads, so it starts from the best plan
+    // that doesn't rebalance, which may not be the best one.
+    size_t search_index = INVALID;
+    Plan search_plan;
+
+    ThreadPool pool(std::min(threads, strategies.size()));
+    pool.parallel_for(strategies.size(), [&](size_t i) {
+        // The first one always runs, so there's a plan.
+        if (i > 0 && seconds > 0 && time_left() < seconds / 2) {
+            std::lock_guard<std::mutex> guard(lock);
+            skipped[i] = true;
+            return;
+        }
 
-    void take(ProductId id, size_t amount) {
-        assert(has(id, amount));
-        m_products_available[id] -= amount;
+        Simulation copy(simulation);
+        Plan plan(copy.m_drones.size());
+        Planner planner(copy, strategies[i], plan);
+        planner.run();
+        plan.optimize();
+
+        ScoreReport report = scorer.score(plan);
+
+        std::lock_guard<std::mutex> guard(lock);
+        reports[i] = report;
+        stats[i] = planner.stats();
+        if (!report.valid)
+            return;
+
+        // Ties go to the first strategy, so the result doesn't depend on
+        // scheduling.
+        auto better = [&](size_t current) {
+            return current == INVALID ||
+                   report.score > reports[current].score ||
+                   (report.score == reports[current].score && i < current);
+        };
+        if (seconds > 0 && !stats[i].rebalancing_trips && better(search_index)) {
+            search_index = i;
+            search_plan = plan;
+        }
+        if (better(best_index)) {
+            best_index = i;
+            best_plan = std::move(plan);
+        }
+    });
+
+    for (size_t i = 0; i < strategies.size(); ++i) {
+        std::cout << (i == best_index ? "* " : "  ") << strategies[i].name() << ": ";
+        if (skipped[i]) {
+            std::cout << "skipped, out of time" << std::endl;
+        } else if (reports[i].valid) {
+            std::cout << reports[i].score << " (" << stats[i].trips << " trips, load factor "
+                      << stats[i].load_factor();
+            if (stats[i].rebalancing_trips)
+                std::cout << ", " << stats[i].rebalancing_trips << " rebalancing trips";
+            std::cout << ")" << std::endl;
+        } else
+            std::cout << "invalid (" << reports[i].error << ")" << std::endl;
     }
 
-    void take(ProductId id) {
-        take(id, 1);
+    if (best_index == INVALID) {
+        std::cerr << "No valid plan" << std::endl;
+        return 1;
     }
 
-    explicit Warehouse(WarehouseId id, size_t x, size_t y): id(id), position(x, y) {}
-};
-
-class Product {
-public:
-    ProductId id;
-    size_t weight;
-
-    explicit Product(ProductId id, size_t weight): id(id), weight(weight) {}
-};
+    if (seconds > 0 && search_index != INVALID) {
+        if (search_index != best_index)
+            std::cout << "local search: starting from " << strategies[search_index].name() << std::endl;
 
-class Order {
-public:
-    OrderId id;
-    Point destination;
-    std::vector<ProductId> m_products;
-    std::vector<bool> m_delivered;
-
-    explicit Order(OrderId id, size_t x, size_t y): id(id), destination(x, y) {}
-
-    void add_product(ProductId id) {
-        m_products.push_back(id);
-        m_delivered.push_back(false);
-    }
+        LocalSearch search(simulation, search_plan);
+        if (search.supported()) {
+            search.run(std::max(time_left(), 0.0)).print(std::cout);
 
-    ProductId next_undelivered_product() {
-        size_t size = m_delivered.size();
-        for (size_t i = 0; i < size; ++i) {
-            if (!m_delivered[i]) {
-                return m_products[i];
+            Plan improved = search.plan();
+            ScoreReport report = scorer.score(improved);
+            if (!report.valid || report.score != search.score()) {
+                std::cerr << "Local search broke the plan: "
+                          << (report.valid ? std::to_string(report.score) : report.error) << std::endl;
+                return 1;
             }
+            if (report.score >= reports[best_index].score)
+                best_plan = std::move(improved);
+        } else {
+            std::cout << "local search: plan not supported" << std::endl;
         }
-        return INVALID;
     }
 
-    void mark_as_delivered(ProductId id) {
-        size_t size = m_delivered.size();
-        for (size_t i = 0; i < size; ++i) {
-            if (m_products[i] == id && !m_delivered[i]) {
-                m_delivered[i] = true;
-                break; // Only mark as delivered the first undelivered product
-            }
-        }
+    if (!best_plan.write_to(output)) {
+        std::cerr << output << ": " << strerror(errno) << std::endl;
+        return 1;
     }
-};
-
-class Drone {
-public:
-    DroneId id;
-    Point position;
-
-    std::vector<ProductId> current_products;
-    size_t expected_unbusy_turn;
-
-    explicit Drone(DroneId id, size_t x, size_t y): id(id), position(x, y), expected_unbusy_turn(0) {}
+    return 0;
+}
 
-    bool unbusy(size_t current_turn) {
-        return expected_unbusy_turn <= current_turn;
+// Loads the input `runs` times, and reports how long it takes per MB.
+int bench_parse(const char* input, size_t runs) {
+    std::vector<double> times;
+    size_t size = 0;
+    for (size_t i = 0; i < std::max<size_t>(runs, 1); ++i) {
+        auto start = std::chrono::steady_clock::now();
+        Simulation simulation(input);
+        auto end = std::chrono::steady_clock::now();
+        times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        size = InputParser(input).size();
     }
 
-};
-
-class Simulation {
-public:
-    size_t m_current_turn;
-    size_t m_width;
-    size_t m_height;
-    size_t m_turns_deadline;
-    size_t m_drone_max_load;
-
-    std::vector<Drone> m_drones;
-
-    std::vector<Product> m_products;
-
-    std::vector<Warehouse> m_warehouses;
-
-    std::vector<Order> m_orders;
-    explicit Simulation(std::ifstream& in);
-
-    DroneId nearest_unbusy_drone(const Point& point) {
-        DroneId drone_id = INVALID;
-        size_t distance = INVALID;
+    std::sort(times.begin(), times.end());
+    double megabytes = size / (1024.0 * 1024.0);
+    double median = times[times.size() / 2];
+    std::cout << input << ": " << size << " bytes, " << times.size() << " runs" << std::endl;
+    std::cout << "min: " << times.front() << " ms, median: " << median << " ms" << std::endl;
+    std::cout << "median: " << median / megabytes << " ms/MB (" << megabytes / (median / 1000) << " MB/s)" << std::endl;
+    return 0;
+}
 
-        for (auto& drone: m_drones) {
-            size_t current_dist = drone.position.distance(point);
-            if (drone.unbusy(m_current_turn) && current_dist <= distance) {
-                distance = current_dist;
-                drone_id = drone.id;
-            }
-        }
+// Benchmarks the default solver on the given inputs. The options go first:
+// --runs N, and --json for JSON instead of CSV.
+int bench(int argc, char** argv) {
+    size_t runs = 20;
+    Benchmark::Format format = Benchmark::CSV;
+    std::vector<const char*> inputs;
+    for (int i = 0; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--runs" && i + 1 < argc)
+            runs = std::stoul(argv[++i]);
+        else if (arg == "--json")
+            format = Benchmark::JSON;
+        else if (arg == "--csv")
+            format = Benchmark::CSV;
+        else
+            inputs.push_back(argv[i]);
+    }
 
-        return drone_id;
+    if (inputs.empty()) {
+        std::cerr << "bench: no inputs" << std::endl;
+        return 1;
     }
 
-    Warehouse& nearest_warehouse_with_product(const Point& point, ProductId product) {
-        WarehouseId id = INVALID;
-        size_t distance = INVALID;
-        for (auto& warehouse: m_warehouses) {
-            size_t current_dist = warehouse.position.distance(point);
-            if (warehouse.has(product) && current_dist <= distance) {
-                distance = current_dist;
-                id = warehouse.id;
+    return Benchmark(runs, format).run(inputs, std::cout) ? 0 : 1;
+}
+
+// Solves the given inputs at once, see BatchRunner. The options go first:
+// --threads N (one per input by default, up to the cores) and --out DIR
+// (output/ by default). Inputs with wildcards get expanded here, so they can
+// be quoted when there are more than the shell takes.
+int batch(int argc, char** argv) {
+    size_t threads = default_thread_count();
+    std::string output_dir = "output";
+    std::vector<std::string> inputs;
+    for (int i = 0; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = std::stoul(argv[++i]);
+        } else if (arg == "--out" && i + 1 < argc) {
+            output_dir = argv[++i];
+        } else if (arg.find_first_of("*?[") != std::string::npos) {
+            glob_t matches;
+            if (glob(argv[i], 0, nullptr, &matches) != 0) {
+                std::cerr << "batch: nothing matches " << arg << std::endl;
+                return 1;
             }
+            for (size_t j = 0; j < matches.gl_pathc; ++j)
+                inputs.push_back(matches.gl_pathv[j]);
+            globfree(&matches);
+        } else {
+            inputs.push_back(arg);
         }
-        assert(id != INVALID);
-        return m_warehouses[id];
     }
-};
-
-Simulation::Simulation(std::ifstream& in) : m_current_turn(0) {
-    std::string line;
-    assert(std::getline(in, line));
 
-    size_t drone_count;
-    {
-        std::istringstream iss(line); // Overkill wut...
-        iss >> m_height;
-        iss >> m_width;
-
-        iss >> drone_count;
-        m_drones.reserve(drone_count);
-
-        iss >> m_turns_deadline;
-        iss >> m_drone_max_load;
+    if (inputs.empty()) {
+        std::cerr << "batch: no inputs" << std::endl;
+        return 1;
     }
 
-    assert(std::getline(in, line));
-
-    size_t product_count = std::stoul(line);
-    assert(product_count < 10000);
-
-    m_products.reserve(product_count);
-
-    assert(std::getline(in, line));
-
-    {
-        std::istringstream iss(line);
-
-        for (size_t i = 0; i < product_count; i++) {
-            size_t weight;
-            iss >> weight;
+    return BatchRunner(output_dir, threads).run(inputs, std::cout) ? 0 : 1;
+}
 
-            assert(weight < m_drone_max_load);
-            m_products.push_back(Product(i, weight));
+// Writes a random instance: key=value options, see InstanceConfig::set().
+int generate(const char* output, int argc, char** argv) {
+    InstanceConfig config;
+    for (int i = 0; i < argc; ++i) {
+        if (!config.set(argv[i])) {
+            std::cerr << "generate: bad option " << argv[i] << std::endl;
+            return 1;
         }
     }
 
-    assert(std::getline(in, line));
-    size_t warehouse_count = std::stoul(line);
-    assert(warehouse_count < 10000);
-
-    m_warehouses.reserve(warehouse_count);
-
-    for (size_t i = 0; i < warehouse_count; i++) {
-        assert(std::getline(in, line));
-
-        size_t x, y;
-        {
-            std::istringstream iss(line);
-            iss >> y;
-            iss >> x;
-        }
-
-        Warehouse this_warehouse(i, x, y);
-
-        assert(x < m_width);
-        assert(y < m_height);
-
-        assert(std::getline(in, line));
-        {
-            std::istringstream iss(line);
-            for (auto& product: m_products) {
-                size_t this_product_count;
-                iss >> this_product_count;
-                this_warehouse.add_product(product.id, this_product_count);
-            }
-        }
+    std::string error = config.check();
+    if (!error.empty()) {
+        std::cerr << "generate: " << error << std::endl;
+        return 1;
+    }
 
-        m_warehouses.push_back(this_warehouse);
+    if (!InstanceGenerator(config).write_to(output)) {
+        std::cerr << output << ": " << strerror(errno) << std::endl;
+        return 1;
     }
+    return 0;
+}
 
-    assert(std::getline(in, line));
-    size_t order_count = std::stoul(line);
-
-    assert(order_count < 10000);
-    for (size_t i = 0; i < order_count; i++) {
-        assert(std::getline(in, line));
-        size_t x, y;
-        {
-            std::istringstream iss(line);
-            iss >> x;
-            iss >> y;
+// Runs the solver on generated instances from 1x to 1000x the base size. The
+// options are like generate's for the base instance, plus timeout=<seconds>
+// per size (60 by default) and factors=<a,b,...>.
+int scale(int argc, char** argv) {
+    InstanceConfig config;
+    unsigned timeout = 60;
+    std::vector<double> factors = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000 };
+    for (int i = 0; i < argc; ++i) {
+        std::string option = argv[i];
+        try {
+            if (option.compare(0, 8, "timeout=") == 0) {
+                timeout = std::stoul(option.substr(8));
+                continue;
+            }
+            if (option.compare(0, 8, "factors=") == 0) {
+                factors.clear();
+                std::string list = option.substr(8);
+                for (size_t start = 0; start <= list.size();) {
+                    size_t comma = std::min(list.find(',', start), list.size());
+                    factors.push_back(std::stod(list.substr(start, comma - start)));
+                    start = comma + 1;
+                }
+                continue;
+            }
+        } catch (const std::exception&) {
+            std::cerr << "scale: bad option " << option << std::endl;
+            return 1;
         }
-
-        Order this_order(i, x, y);
-
-        assert(std::getline(in, line));
-        size_t product_count = std::stoul(line);
-
-        assert(std::getline(in, line));
-        std::istringstream iss(line);
-        for (size_t i = 0; i < product_count; i++) {
-            ProductId id;
-            iss >> id;
-            assert(id < m_products.size());
-            this_order.add_product(id);
+        if (!config.set(option)) {
+            std::cerr << "scale: bad option " << option << std::endl;
+            return 1;
         }
-
-        m_orders.push_back(this_order);
     }
 
-    for (size_t i = 0; i < drone_count; i++) {
-        m_drones.push_back(Drone(i, m_warehouses[0].position.x, m_warehouses[0].position.y));
+    std::string error = config.check();
+    if (!error.empty()) {
+        std::cerr << "scale: " << error << std::endl;
+        return 1;
     }
 
-    std::cout << "(" << m_width << ", " << m_height << ")" << std::endl;
-    std::cout << m_turns_deadline << " turns" << std::endl;
-    std::cout << m_drones.size() << " drones" << std::endl;
-    std::cout << m_warehouses.size() << " warehouses" << std::endl;
-    std::cout << m_products.size() << " products" << std::endl;
-    std::cout << m_orders.size() << " orders" << std::endl;
+    return ScaleTest(config, timeout).run(factors, std::cout) ? 0 : 1;
 }
 
-int main(int argc, char** argv) {
-    if (argc <= 2) {
-        std::cerr << "Usage: " << argv[0] << " <in> <out>" << std::endl;
-        return 1;
+int run(int argc, char** argv) {
+    if (argc > 1 && std::string(argv[1]) == "selftest")
+        return SelfTest(std::cout).run() ? 0 : 1;
+
+    if (argc > 1 && std::string(argv[1]) == "bench")
+        return bench(argc - 2, argv + 2);
+
+    if (argc > 1 && std::string(argv[1]) == "batch")
+        return batch(argc - 2, argv + 2);
+
+    if (argc > 2 && std::string(argv[1]) == "generate")
+        return generate(argv[2], argc - 3, argv + 3);
+
+    if (argc > 1 && std::string(argv[1]) == "scale")
+        return scale(argc - 2, argv + 2);
+
+    if (argc > 2 && std::string(argv[1]) == "bench-parse")
+        return bench_parse(argv[2], argc > 3 ? std::stoul(argv[3]) : 20);
+
+    if (argc > 3 && std::string(argv[1]) == "score")
+        return score(argv[2], argv[3]);
+
+    if (argc > 3 && std::string(argv[1]) == "best")
+        return best(argv[2], argv[3],
+                    argc > 4 ? std::stoul(argv[4]) : default_thread_count(),
+                    argc > 5 ? std::stod(argv[5]) : 0);
+
+    // With --stats, the counters and timers go to stderr as JSON at the end.
+    // --rebalance has idle drones move stock between warehouses, see
+    // rebalancer.h.
+    bool stats = false;
+    Strategy strategy;
+    size_t threads = 1;
+    bool usage = argc <= 2;
+    for (int i = 3; i < argc && !usage; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--stats")
+            stats = true;
+        else if (arg == "--rebalance")
+            strategy.rebalance = true;
+        else if (arg == "--threads" && i + 1 < argc)
+            threads = std::stoul(argv[++i]);
+        else
+            usage = true;
     }
 
-    std::ifstream in(argv[1]);
-    assert(in);
-
-    std::ofstream out(argv[2]);
-    assert(out);
-
-    Simulation simulation(in);
-
-    std::vector<Command> commands;
-
-    for (size_t turn = 0; turn < simulation.m_turns_deadline; ++turn) {
-        std::cout << "Simulating turn: " << turn << std::endl;
-        simulation.m_current_turn = turn;
-        for (auto& order: simulation.m_orders) {
-            ProductId next_product_to_deliver = order.next_undelivered_product();
-            if (next_product_to_deliver == INVALID)
-                continue; // Next order
-
-            auto& warehouse = simulation.nearest_warehouse_with_product(order.destination, next_product_to_deliver);
-
-            DroneId drone_id = simulation.nearest_unbusy_drone(warehouse.position);
-            if (drone_id == INVALID)
-                continue;
-
-            order.mark_as_delivered(next_product_to_deliver);
-
-            auto& drone = simulation.m_drones[drone_id];
-
-            warehouse.take(next_product_to_deliver);
-
-            out << LoadCommand(drone_id, warehouse.id, next_product_to_deliver, 1) << std::endl;
-            size_t delta = drone.position.distance(warehouse.position) + 1;
-
-            delta += warehouse.position.distance(order.destination);
-
-            std::vector<ProductId> to_deliver;
-            to_deliver.push_back(next_product_to_deliver);
-
-
-            size_t weight = simulation.m_products[next_product_to_deliver].weight;
-            while (true) {
-                ProductId next = order.next_undelivered_product();
-                if (next == INVALID)
-                    break;
-
-                if (!warehouse.has(next))
-                    break;
+    if (usage) {
+        std::cerr << "Usage: " << argv[0] << " <in> <out> [--stats] [--threads N]" << std::endl;
+        std::cerr << "       " << argv[0] << " best <in> <out> [threads] [seconds]" << std::endl;
+        std::cerr << "       " << argv[0] << " score <in> <commands>" << std::endl;
+        std::cerr << "       " << argv[0] << " bench [--runs N] [--json] <in>..." << std::endl;
+        std::cerr << "       " << argv[0] << " bench-parse <in> [runs]" << std::endl;
+        std::cerr << "       " << argv[0] << " batch [--threads N] [--out DIR] <in>..." << std::endl;
+        std::cerr << "       " << argv[0] << " generate <out> [key=value...]" << std::endl;
+        std::cerr << "       " << argv[0] << " selftest" << std::endl;
+        std::cerr << "       " << argv[0] << " scale [timeout=S] [factors=1,2,...] [key=value...]" << std::endl;
+        return 1;
+    }
 
-                weight += simulation.m_products[next].weight;
-                if (weight > simulation.m_drone_max_load)
-                    break;
+    auto start = std::chrono::steady_clock::now();
+    Simulation simulation(argv[1]);
+    auto parsed = std::chrono::steady_clock::now();
+    simulation.print_summary(std::cout);
 
-                order.mark_as_delivered(next);
-                warehouse.take(next);
-                out << LoadCommand(drone_id, warehouse.id, next, 1) << std::endl;
-                delta += 1;
-                to_deliver.push_back(next);
-            }
-
-            for (auto id: to_deliver) {
-                delta += 1;
-                out << DeliverCommand(drone_id, order.id, id, 1) << std::endl;
-            }
+    Instrumentation& instrumentation = simulation.m_instrumentation;
+    instrumentation.enable_timers(stats);
+    if (instrumentation.timing()) {
+        instrumentation.add_time(Instrumentation::PARSE,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(parsed - start).count());
+    }
 
-            drone.expected_unbusy_turn = turn + delta;
-            drone.position = order.destination;
-        }
+    Plan out(simulation.m_drones.size());
+    ProgressReporter progress(std::cout);
+    Planner planner(simulation, strategy, out, &progress);
+    planner.set_threads(threads);
+    planner.run();
+    planner.stats().print(std::cout);
+    out.optimize();
 
-        bool all_unbusy = true;
-        for (auto& drone: simulation.m_drones) {
-            if (!drone.unbusy(turn)) {
-                all_unbusy = false;
-                break;
-            }
+    {
+        Instrumentation::Scope scope(instrumentation, Instrumentation::EMIT);
+        if (!out.write_to(argv[2])) {
+            std::cerr << argv[2] << ": " << strerror(errno) << std::endl;
+            return 1;
         }
+    }
 
-        if (all_unbusy) {
-            break; // ITS OVER!!
-        }
+    if (stats)
+        instrumentation.print_json(std::cerr);
+    return 0;
+}
 
-        for (auto& drone: simulation.m_drones) {
-            if (drone.unbusy(turn)) {
-                out << WaitCommand(drone.id, 1) << std::endl;
-            }
-        }
+int main(int argc, char** argv) {
+    try {
+        return run(argc, argv);
+    } catch (const ParseError& error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
     }
 }
@@ -0,0 +1,251 @@
+#ifndef REBALANCER_H
+#define REBALANCER_H
+
+#include <vector>
+#include <queue>
+#include <functional>
+#include <algorithm>
+#include <utility>
+
+#include <cassert>
+#include <cstdint>
+
+#include "commands.h"
+#include "simulation.h"
+
+// Moves stock between warehouses ahead of the orders that need it.
+//
+// Every order belongs to the region of its nearest warehouse, which is where
+// we'd like to serve it from. The demand of a region is what its pending
+// orders still need. When a region's warehouse is short of a product that
+// another warehouse has more of than its own region needs, a drone can carry
+// the difference over with loads and unloads, so later deliveries start from
+// next door instead of from across the map.
+//
+// Stock leaves the source when the transfer is planned, and only shows up at
+// the destination the turn the drone lands, so no delivery planned before
+// then can count on it. Only the shortages there were at the start are
+// considered: stock runs out later too, but chasing that would mean scanning
+// every warehouse and product all the time.
+class Rebalancer {
+public:
+    typedef std::pair<ProductId, uint32_t> Entry;
+
+    // A planned trip: load `items` at `from`, unload them at `to`.
+    struct Transfer {
+        WarehouseId from;
+        WarehouseId to;
+        std::vector<Entry> items;
+        size_t weight;
+        size_t gain;
+
+        Transfer(): from(INVALID), to(INVALID), weight(0), gain(0) {}
+
+        size_t item_count() const {
+            size_t count = 0;
+            for (auto& entry: items)
+                count += entry.second;
+            return count;
+        }
+    };
+
+private:
+    struct Arrival {
+        size_t turn;
+        WarehouseId warehouse;
+        ProductId product;
+        uint32_t count;
+
+        bool operator>(const Arrival& other) const {
+            return turn > other.turn;
+        }
+    };
+
+    Simulation& m_simulation;
+    size_t m_product_count;
+
+    // Per order, the warehouse whose region it's in.
+    std::vector<WarehouseId> m_region;
+
+    // Warehouse x product, like the inventory: units the pending orders of
+    // the region still need, and units on their way there.
+    std::vector<uint32_t> m_demand;
+    std::vector<uint32_t> m_incoming;
+
+    // Per warehouse, the products it was short of at the start. Entries are
+    // dropped once the shortage is covered.
+    std::vector<std::vector<ProductId>> m_shortages;
+
+    std::priority_queue<Arrival, std::vector<Arrival>, std::greater<Arrival>> m_arrivals;
+
+    size_t index(WarehouseId warehouse, ProductId product) const {
+        return size_t(warehouse) * m_product_count + product;
+    }
+
+    size_t stock(WarehouseId warehouse, ProductId product) const {
+        return m_simulation.m_inventory.count(warehouse, product);
+    }
+
+    size_t shortage(WarehouseId warehouse, ProductId product) const {
+        size_t i = index(warehouse, product);
+        size_t covered = stock(warehouse, product) + m_incoming[i];
+        return m_demand[i] > covered ? m_demand[i] - covered : 0;
+    }
+
+    size_t surplus(WarehouseId warehouse, ProductId product) const {
+        size_t available = stock(warehouse, product);
+        size_t needed = m_demand[index(warehouse, product)];
+        return available > needed ? available - needed : 0;
+    }
+
+    // The nearest warehouse to `to` with a surplus of `product`, or INVALID.
+    WarehouseId nearest_source(WarehouseId to, ProductId product) const {
+        const DistanceTables& distances = *m_simulation.m_distances;
+        WarehouseId best = INVALID;
+        size_t best_distance = INVALID;
+        for (auto holder: m_simulation.m_inventory.holders(product)) {
+            if (holder == to || !surplus(holder, product))
+                continue;
+            size_t distance = distances.warehouse_to_warehouse(holder, to);
+            if (distance < best_distance || (distance == best_distance && holder < best)) {
+                best = holder;
+                best_distance = distance;
+            }
+        }
+        return best;
+    }
+
+public:
+    explicit Rebalancer(Simulation& simulation)
+        : m_simulation(simulation)
+        , m_product_count(simulation.m_products.size())
+        , m_region(simulation.m_orders.size(), INVALID)
+        , m_demand(simulation.m_warehouses.size() * m_product_count, 0)
+        , m_incoming(m_demand.size(), 0)
+        , m_shortages(simulation.m_warehouses.size()) {
+        const DistanceTables& distances = *simulation.m_distances;
+        for (auto& order: simulation.m_orders) {
+            if (order.complete())
+                continue;
+
+            WarehouseId region = 0;
+            for (WarehouseId w = 1; w < simulation.m_warehouses.size(); ++w) {
+                if (distances.warehouse_to_order(w, order.id) < distances.warehouse_to_order(region, order.id))
+                    region = w;
+            }
+            m_region[order.id] = region;
+
+            for (size_t i = 0; i < order.item_count(); ++i) {
+                if (!order.delivered(i))
+                    m_demand[index(region, order.product(i))]++;
+            }
+        }
+
+        for (WarehouseId w = 0; w < simulation.m_warehouses.size(); ++w) {
+            for (ProductId product = 0; product < m_product_count; ++product) {
+                if (shortage(w, product))
+                    m_shortages[w].push_back(product);
+            }
+        }
+    }
+
+    // An item of the order got loaded, from wherever.
+    void delivered(OrderId order, ProductId product) {
+        WarehouseId region = m_region[order];
+        if (region == INVALID)
+            return;
+        uint32_t& demand = m_demand[index(region, product)];
+        if (demand)
+            demand--;
+    }
+
+    // Puts the stock that has landed by `turn` into its warehouse.
+    void arrive(size_t turn) {
+        while (!m_arrivals.empty() && m_arrivals.top().turn <= turn) {
+            const Arrival& arrival = m_arrivals.top();
+            Warehouse& warehouse = m_simulation.m_warehouses[arrival.warehouse];
+            warehouse.put(arrival.product, arrival.count);
+            m_incoming[index(arrival.warehouse, arrival.product)] -= arrival.count;
+            m_arrivals.pop();
+        }
+    }
+
+    // The transfer that saves the most flying, if any: for each warehouse
+    // still short of something, everything the nearest source of its first
+    // shortage can cover, up to `max_load`. The gain is the distance between
+    // the two for each unit moved, which is what a delivery from the source
+    // would fly on top of one from the destination, at worst.
+    bool best_transfer(size_t max_load, Transfer& best) {
+        const DistanceTables& distances = *m_simulation.m_distances;
+        best = Transfer();
+
+        for (WarehouseId to = 0; to < m_shortages.size(); ++to) {
+            auto& shortages = m_shortages[to];
+            shortages.erase(std::remove_if(shortages.begin(), shortages.end(), [&](ProductId product) {
+                return !shortage(to, product);
+            }), shortages.end());
+
+            WarehouseId from = INVALID;
+            for (auto product: shortages) {
+                from = nearest_source(to, product);
+                if (from != INVALID)
+                    break;
+            }
+            if (from == INVALID)
+                continue;
+
+            Transfer transfer;
+            transfer.from = from;
+            transfer.to = to;
+            for (auto product: shortages) {
+                // The parser takes weightless products, which always fit.
+                size_t weight = m_simulation.m_products[product].weight;
+                size_t fits = weight ? (max_load - transfer.weight) / weight : SIZE_MAX;
+                size_t count = std::min(std::min(shortage(to, product), surplus(from, product)), fits);
+                count = std::min(count, size_t(Command::MAX_COUNT));
+                if (!count)
+                    continue;
+                transfer.items.push_back(Entry(product, count));
+                transfer.weight += count * weight;
+            }
+
+            transfer.gain = transfer.item_count() * distances.warehouse_to_warehouse(from, to);
+            if (transfer.gain > best.gain)
+                best = std::move(transfer);
+        }
+
+        return best.gain > 0;
+    }
+
+    // Plans the transfer for the drone, which is at `position` and leaves
+    // at `turn`. Returns how many turns the trip takes.
+    size_t dispatch(DroneId drone, const Point& position, const Transfer& transfer,
+                    size_t turn, Plan& out) {
+        Warehouse& from = m_simulation.m_warehouses[transfer.from];
+        const Warehouse& to = m_simulation.m_warehouses[transfer.to];
+
+        size_t turns = position.distance(from.position);
+        for (auto& entry: transfer.items) {
+            from.take(entry.first, entry.second);
+            out.add(Command::load(drone, from.id, entry.first, entry.second));
+            turns++;
+        }
+
+        turns += m_simulation.m_distances->warehouse_to_warehouse(from.id, to.id);
+        for (auto& entry: transfer.items) {
+            out.add(Command::unload(drone, to.id, entry.first, entry.second));
+            m_incoming[index(to.id, entry.first)] += entry.second;
+            turns++;
+        }
+
+        // The unloads are done by the last turn of the trip, so the stock is
+        // there for anybody planned from the next one on.
+        for (auto& entry: transfer.items) {
+            Arrival arrival = { turn + turns, to.id, entry.first, entry.second };
+            m_arrivals.push(arrival);
+        }
+        return turns;
+    }
+};
+
+#endif
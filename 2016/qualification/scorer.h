@@ -0,0 +1,320 @@
+#ifndef SCORER_H
+#define SCORER_H
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <queue>
+#include <functional>
+#include <algorithm>
+#include <utility>
+
+#include <cassert>
+#include <cstdint>
+
+#include "commands.h"
+#include "simulation.h"
+
+// Result of replaying a command file.
+struct ScoreReport {
+    bool valid;
+    std::string error;
+    size_t score;
+    size_t completed_orders;
+    size_t commands;
+    size_t last_turn;
+
+    ScoreReport()
+        : valid(true), score(0), completed_orders(0), commands(0), last_turn(0) {}
+};
+
+// Replays the commands of every drone against the instance, checking payload
+// limits and stock, and computes the official score: for each completed order,
+// ceil(100 * (T - t) / T), where t is the turn of its last delivery.
+//
+// Loads and unloads happen on the last turn of the command (after flying), and
+// are applied in turn order across drones, so stock brought by an unload can
+// be loaded by another drone later. In the same turn, unloads and deliveries
+// go before loads, then by drone id.
+//
+// It keeps its own copy of the initial stock, so it can be built before
+// planning and used after it.
+class Scorer {
+    struct DroneState {
+        Point position;
+        size_t free_at;
+        size_t load;
+        std::vector<std::pair<ProductId, uint32_t>> carried;
+        size_t next;
+
+        explicit DroneState(const Point& position)
+            : position(position), free_at(0), load(0), next(0) {}
+
+        uint32_t& carried_count(ProductId product) {
+            for (auto& entry: carried) {
+                if (entry.first == product)
+                    return entry.second;
+            }
+            carried.push_back(std::make_pair(product, 0));
+            return carried.back().second;
+        }
+    };
+
+    const Simulation& m_simulation;
+    Inventory m_initial_stock;
+
+    // What each order wants, as (product, count) pairs sorted by product, all
+    // the orders in the same array.
+    std::vector<uint32_t> m_demand_offsets;
+    std::vector<std::pair<ProductId, uint32_t>> m_demand;
+    std::vector<uint32_t> m_remaining_items;
+
+    // Where a command came from, for error messages: its line if we parsed
+    // it, otherwise its position in the plan.
+    const std::vector<std::vector<uint32_t>>* m_lines;
+
+    bool fail(ScoreReport& report, DroneId drone, size_t index,
+              const std::string& message) const {
+        report.valid = false;
+        if (m_lines)
+            report.error = "line " + std::to_string((*m_lines)[drone][index]);
+        else
+            report.error = "drone " + std::to_string(drone) + ", command " + std::to_string(index);
+        report.error += ": " + message;
+        return false;
+    }
+
+    uint32_t* demand_for(OrderId order, ProductId product) {
+        auto first = m_demand.begin() + m_demand_offsets[order];
+        auto last = m_demand.begin() + m_demand_offsets[order + 1];
+        auto it = std::lower_bound(first, last, std::make_pair(product, uint32_t(0)));
+        if (it == last || it->first != product)
+            return nullptr;
+        return &it->second;
+    }
+
+public:
+    explicit Scorer(const Simulation& simulation)
+        : m_simulation(simulation)
+        , m_initial_stock(simulation.m_inventory)
+        , m_lines(nullptr) {
+        m_demand_offsets.reserve(simulation.m_orders.size() + 1);
+        std::vector<ProductId> products;
+        for (auto& order: simulation.m_orders) {
+            m_demand_offsets.push_back(m_demand.size());
+            m_remaining_items.push_back(order.item_count());
+
+            products.clear();
+            for (size_t i = 0; i < order.item_count(); ++i)
+                products.push_back(order.product(i));
+            std::sort(products.begin(), products.end());
+            for (auto product: products) {
+                if (m_demand.size() > m_demand_offsets.back() && m_demand.back().first == product)
+                    m_demand.back().second++;
+                else
+                    m_demand.push_back(std::make_pair(product, 1));
+            }
+        }
+        m_demand_offsets.push_back(m_demand.size());
+    }
+
+    ScoreReport score(const Plan& plan) const {
+        // Scoring eats up the demand, so work on a copy.
+        Scorer replay(*this);
+        return replay.replay(plan);
+    }
+
+    ScoreReport score(const std::string& text) const {
+        ScoreReport report;
+        Plan plan;
+        std::vector<std::vector<uint32_t>> lines;
+        if (!Plan::parse(text.data(), text.data() + text.size(),
+                         m_simulation.m_drones.size(), plan, &lines, report.error)) {
+            report.valid = false;
+            return report;
+        }
+
+        Scorer replay(*this);
+        replay.m_lines = &lines;
+        return replay.replay(plan);
+    }
+
+    ScoreReport score_file(const char* path) const {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            ScoreReport report;
+            report.valid = false;
+            report.error = std::string("can't open ") + path;
+            return report;
+        }
+
+        std::string text;
+        in.seekg(0, std::ios::end);
+        text.resize(static_cast<size_t>(in.tellg()));
+        in.seekg(0, std::ios::beg);
+        in.read(&text[0], text.size());
+        return score(text);
+    }
+
+private:
+    ScoreReport replay(const Plan& plan) {
+        ScoreReport report;
+        report.commands = plan.count();
+
+        const Simulation& simulation = m_simulation;
+        const size_t deadline = simulation.m_turns_deadline;
+        Inventory stock(m_initial_stock);
+
+        std::vector<DroneState> drones;
+        drones.reserve(simulation.m_drones.size());
+        for (size_t i = 0; i < simulation.m_drones.size(); ++i)
+            drones.push_back(DroneState(simulation.m_warehouses[0].position));
+
+        for (DroneId id = 0; id < plan.drone_count(); ++id) {
+            const std::vector<Command>& commands = plan.drone(id);
+            for (size_t i = 0; i < commands.size(); ++i) {
+                const Command& command = commands[i];
+                if (id >= drones.size()) {
+                    fail(report, id, i, "no such drone");
+                    return report;
+                }
+
+                bool valid_target = true;
+                if (command.type == LOAD || command.type == UNLOAD)
+                    valid_target = command.target < simulation.m_warehouses.size();
+                else if (command.type == DELIVER)
+                    valid_target = command.target < simulation.m_orders.size();
+
+                if (!valid_target) {
+                    fail(report, id, i, "no such warehouse or order");
+                    return report;
+                }
+
+                if (command.type != WAIT && command.product >= simulation.m_products.size()) {
+                    fail(report, id, i, "no such product");
+                    return report;
+                }
+            }
+        }
+
+        auto commands_of = [&](DroneId id) -> const std::vector<Command>& {
+            static const std::vector<Command> NONE;
+            return id < plan.drone_count() ? plan.drone(id) : NONE;
+        };
+
+        // (turn the action happens, unloads and deliveries first, drone)
+        typedef std::pair<std::pair<size_t, int>, DroneId> Action;
+        std::priority_queue<Action, std::vector<Action>, std::greater<Action>> actions;
+
+        // Schedules the next command of the drone that does something with
+        // stock, going through the waits directly.
+        auto schedule = [&](DroneId id) -> bool {
+            DroneState& drone = drones[id];
+            const std::vector<Command>& commands = commands_of(id);
+            while (drone.next < commands.size()) {
+                const Command& command = commands[drone.next];
+                if (command.type == WAIT) {
+                    drone.free_at += command.target;
+                    drone.next++;
+                    if (drone.free_at > deadline)
+                        return fail(report, id, drone.next - 1, "drone busy past the deadline");
+                    continue;
+                }
+
+                const Point& target = command.type == DELIVER
+                    ? simulation.m_orders[command.target].destination
+                    : simulation.m_warehouses[command.target].position;
+                size_t turn = drone.free_at + drone.position.distance(target);
+                if (turn + 1 > deadline)
+                    return fail(report, id, drone.next, "drone busy past the deadline");
+
+                actions.push(Action(std::make_pair(turn, command.type == LOAD ? 1 : 0), id));
+                return true;
+            }
+            return true;
+        };
+
+        for (DroneId id = 0; id < drones.size(); ++id) {
+            if (!schedule(id))
+                return report;
+        }
+
+        while (!actions.empty()) {
+            Action action = actions.top();
+            actions.pop();
+
+            size_t turn = action.first.first;
+            DroneId id = action.second;
+            DroneState& drone = drones[id];
+            const Command& command = commands_of(id)[drone.next];
+            size_t weight = simulation.m_products[command.product].weight * command.count;
+
+            switch (command.type) {
+                case LOAD: {
+                    if (stock.count(command.target, command.product) < command.count) {
+                        fail(report, id, drone.next, "warehouse out of stock");
+                        return report;
+                    }
+                    if (drone.load + weight > simulation.m_drone_max_load) {
+                        fail(report, id, drone.next, "drone overloaded");
+                        return report;
+                    }
+                    stock.take(command.target, command.product, command.count);
+                    drone.carried_count(command.product) += command.count;
+                    drone.load += weight;
+                    drone.position = simulation.m_warehouses[command.target].position;
+                    break;
+                }
+                case UNLOAD:
+                case DELIVER: {
+                    uint32_t& carried = drone.carried_count(command.product);
+                    if (carried < command.count) {
+                        fail(report, id, drone.next, "drone doesn't carry that much");
+                        return report;
+                    }
+                    carried -= command.count;
+                    drone.load -= weight;
+
+                    if (command.type == UNLOAD) {
+                        size_t current = stock.count(command.target, command.product);
+                        stock.set(command.target, command.product, current + command.count);
+                        drone.position = simulation.m_warehouses[command.target].position;
+                        break;
+                    }
+
+                    uint32_t* wanted = demand_for(command.target, command.product);
+                    if (!wanted || *wanted < command.count) {
+                        fail(report, id, drone.next, "order doesn't need that much");
+                        return report;
+                    }
+                    *wanted -= command.count;
+                    drone.position = simulation.m_orders[command.target].destination;
+
+                    m_remaining_items[command.target] -= command.count;
+                    if (!m_remaining_items[command.target]) {
+                        report.completed_orders++;
+                        report.score += (100 * (deadline - turn) + deadline - 1) / deadline;
+                    }
+                    break;
+                }
+                default:
+                    assert(0 && "Waits are never scheduled");
+            }
+
+            drone.free_at = turn + 1;
+            report.last_turn = std::max(report.last_turn, drone.free_at);
+            drone.next++;
+
+            if (!schedule(id))
+                return report;
+        }
+
+        for (auto& drone: drones)
+            report.last_turn = std::max(report.last_turn, drone.free_at);
+
+        return report;
+    }
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+#include <iostream>
+#include <vector>
+
+#include <cstdint>
+
+#include "point.h"
+#include "distance.h"
+
+// Known distances, checked against ceil_distance and every batched kernel the
+// build has, in both directions. Unlike the assertions in DistanceTables this
+// doesn't use ceil_distance as the reference, and still runs with NDEBUG.
+//
+// The cases have the other point on every side of the first one, so an
+// unsigned subtraction that wraps around would show up, plus some where the
+// square root isn't a whole number and has to be rounded up.
+class SelfTest {
+    struct DistanceCase {
+        uint32_t x1, y1, x2, y2;
+        uint32_t expected;
+    };
+
+    std::ostream& m_out;
+    size_t m_checks;
+    size_t m_failures;
+
+    void check(const char* what, const DistanceCase& c, size_t got) {
+        m_checks++;
+        if (got == c.expected)
+            return;
+        m_failures++;
+        m_out << what << ": (" << c.x1 << ", " << c.y1 << ") -> (" << c.x2 << ", " << c.y2
+              << ") is " << got << ", expected " << c.expected << std::endl;
+    }
+
+    typedef void (*Kernel)(size_t, size_t, const int32_t*, const int32_t*, size_t, uint32_t*);
+
+    // Runs the kernel with the target repeated enough times to go through
+    // both its vector loop and its scalar tail.
+    void check_kernel(const char* what, Kernel kernel, const DistanceCase& c) {
+        const size_t count = 11;
+        std::vector<int32_t> xs(count, c.x2), ys(count, c.y2);
+        std::vector<uint32_t> out(count, INVALID);
+        kernel(c.x1, c.y1, xs.data(), ys.data(), count, out.data());
+        for (size_t i = 0; i < count; ++i)
+            check(what, c, out[i]);
+    }
+
+    void check_distance(const DistanceCase& c) {
+        check("ceil_distance", c, ceil_distance(c.x1, c.y1, c.x2, c.y2));
+        check("Point::distance", c, Point(c.x1, c.y1).distance(Point(c.x2, c.y2)));
+        check_kernel("distances_from_scalar", distances_from_scalar, c);
+        check_kernel("distances_from", distances_from, c);
+#ifdef DISTANCE_KERNEL_X86
+        check_kernel("distances_from_sse2", distances_from_sse2, c);
+        if (__builtin_cpu_supports("avx2"))
+            check_kernel("distances_from_avx2", distances_from_avx2, c);
+        else
+            m_out << "no AVX2 here, distances_from_avx2 not checked" << std::endl;
+#endif
+    }
+
+public:
+    explicit SelfTest(std::ostream& out)
+        : m_out(out), m_checks(0), m_failures(0) {}
+
+    // Returns false if anything failed.
+    bool run() {
+        const DistanceCase cases[] = {
+            { 0, 0, 0, 0, 0 },
+            { 0, 0, 3, 4, 5 },
+            { 10, 10, 13, 14, 5 },   // x < other.x, y < other.y
+            { 2, 7, 5, 3, 5 },       // x < other.x, y > other.y
+            { 0, 0, 7, 0, 7 },
+            { 0, 0, 0, 9, 9 },
+            { 0, 0, 1, 1, 2 },       // sqrt(2)
+            { 0, 0, 1, 2, 3 },       // sqrt(5)
+            { 0, 0, 2, 2, 3 },       // sqrt(8)
+            { 4, 4, 6, 7, 4 },       // sqrt(13)
+            { 0, 0, 30000, 40000, 50000 },
+            { 0, 0, 1, 30000, 30001 }, // Just above a whole number
+            { 0, 0, 3000000, 4000000, 5000000 },
+        };
+
+        for (auto& c: cases) {
+            check_distance(c);
+            DistanceCase reversed = { c.x2, c.y2, c.x1, c.y1, c.expected };
+            check_distance(reversed);
+        }
+
+        m_out << "distances: " << m_checks - m_failures << " / " << m_checks
+              << " checks passed" << std::endl;
+        return m_failures == 0;
+    }
+};
+
+#endif
@@ -0,0 +1,517 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <algorithm>
+
+#include <cassert>
+#include <cstdint>
+
+#include "point.h"
+#include "spatial_index.h"
+#include "inventory.h"
+#include "distance.h"
+#include "parser.h"
+#include "instrumentation.h"
+
+class Warehouse {
+public:
+    WarehouseId id;
+    Point position;
+    Inventory* m_inventory;
+
+    void add_product(ProductId id, size_t available) {
+        m_inventory->set(this->id, id, available);
+    }
+
+    bool has(ProductId id, size_t amount) const {
+        return m_inventory->count(this->id, id) >= amount;
+    }
+
+    bool has(ProductId id) const {
+        return has(id, 1);
+    }
+
+    void take(ProductId id, size_t amount) {
+        assert(has(id, amount));
+        m_inventory->take(this->id, id, amount);
+    }
+
+    void take(ProductId id) {
+        take(id, 1);
+    }
+
+    void put(ProductId id, size_t amount) {
+        m_inventory->set(this->id, id, m_inventory->count(this->id, id) + amount);
+    }
+
+    explicit Warehouse(WarehouseId id, size_t x, size_t y, Inventory* inventory)
+        : id(id), position(x, y), m_inventory(inventory) {}
+};
+
+class Product {
+public:
+    ProductId id;
+    uint32_t weight;
+
+    explicit Product(ProductId id, size_t weight): id(id), weight(static_cast<uint32_t>(weight)) {}
+};
+
+// The lines of every order, flattened: each order is a range of items and a
+// range of demands in these arrays. That's a handful of allocations for the
+// whole instance instead of several per order, and walking the orders walks
+// memory in order.
+//
+// The simulation owns it, and the orders point to it, see the copy
+// constructor.
+struct OrderLines {
+    // The items of one product in an order, as a range of items_by_product.
+    struct Demand {
+        ProductId product;
+        uint32_t next;
+        uint32_t remaining;
+    };
+
+    // Per item.
+    std::vector<ProductId> products;
+    std::vector<uint8_t> delivered;
+    // Item indices within the order, grouped by product, in order within
+    // each product.
+    std::vector<uint32_t> items_by_product;
+
+    // Per order, sorted by product.
+    std::vector<Demand> demand;
+
+    // The catalog weights, so orders don't need the catalog.
+    std::vector<uint32_t> weights;
+};
+
+// An order, and what's left of it.
+//
+// Items are delivered in any order, but the planner mostly takes the first
+// pending one, so on top of the per-item flags there's a cursor to it, and the
+// items of each product are grouped so we can find the first pending one of a
+// product without going through the whole order.
+class Order {
+    typedef OrderLines::Demand Demand;
+
+    OrderLines* m_lines;
+    uint32_t m_first_item;
+    uint32_t m_item_count;
+    uint32_t m_first_demand;
+    uint32_t m_demand_count;
+
+    uint32_t m_cursor;
+    uint32_t m_remaining_items;
+    uint64_t m_remaining_weight;
+
+    Demand* demand_begin() const {
+        return m_lines->demand.data() + m_first_demand;
+    }
+
+    Demand* find_demand(ProductId product) const {
+        Demand* first = demand_begin();
+        Demand* last = first + m_demand_count;
+        Demand* it = std::lower_bound(first, last, product, [](const Demand& demand, ProductId product) {
+            return demand.product < product;
+        });
+        if (it == last || it->product != product)
+            return nullptr;
+        return it;
+    }
+
+    uint8_t& delivered_flag(size_t item) const {
+        return m_lines->delivered[m_first_item + item];
+    }
+
+public:
+    OrderId id;
+    Point destination;
+
+    // Appends the order's lines to `lines`.
+    explicit Order(OrderId id, size_t x, size_t y,
+                   const ProductId* products, size_t item_count,
+                   OrderLines& lines)
+        : m_lines(&lines)
+        , m_first_item(static_cast<uint32_t>(lines.products.size()))
+        , m_item_count(static_cast<uint32_t>(item_count))
+        , m_first_demand(static_cast<uint32_t>(lines.demand.size()))
+        , m_demand_count(0)
+        , m_cursor(0)
+        , m_remaining_items(static_cast<uint32_t>(item_count))
+        , m_remaining_weight(0)
+        , id(id)
+        , destination(x, y) {
+        lines.products.insert(lines.products.end(), products, products + item_count);
+        lines.delivered.resize(lines.delivered.size() + item_count, 0);
+
+        size_t grouped = lines.items_by_product.size();
+        for (size_t i = 0; i < item_count; ++i) {
+            lines.items_by_product.push_back(static_cast<uint32_t>(i));
+            m_remaining_weight += lines.weights[products[i]];
+        }
+
+        std::stable_sort(lines.items_by_product.begin() + grouped, lines.items_by_product.end(),
+                         [products](uint32_t a, uint32_t b) {
+            return products[a] < products[b];
+        });
+
+        for (size_t i = 0; i < item_count; ++i) {
+            ProductId product = products[lines.items_by_product[grouped + i]];
+            if (!m_demand_count || lines.demand.back().product != product) {
+                Demand demand = { product, static_cast<uint32_t>(i), 0 };
+                lines.demand.push_back(demand);
+                m_demand_count++;
+            }
+            lines.demand.back().remaining++;
+        }
+    }
+
+    // Points the order to a copy of the lines it was built with.
+    void attach(OrderLines* lines) {
+        m_lines = lines;
+    }
+
+    size_t item_count() const {
+        return m_item_count;
+    }
+
+    ProductId product(size_t item) const {
+        assert(item < m_item_count);
+        return m_lines->products[m_first_item + item];
+    }
+
+    bool complete() const {
+        return !m_remaining_items;
+    }
+
+    size_t remaining_items() const {
+        return m_remaining_items;
+    }
+
+    size_t remaining_weight() const {
+        return m_remaining_weight;
+    }
+
+    size_t remaining(ProductId product) const {
+        Demand* demand = find_demand(product);
+        return demand ? demand->remaining : 0;
+    }
+
+    bool delivered(size_t item) const {
+        return delivered_flag(item);
+    }
+
+    // The first item that hasn't been delivered, or INVALID.
+    size_t next_undelivered_item() const {
+        return complete() ? INVALID : m_cursor;
+    }
+
+    ProductId next_undelivered_product() const {
+        return complete() ? INVALID : product(m_cursor);
+    }
+
+    void mark_item_as_delivered(size_t item) {
+        assert(!delivered_flag(item));
+        ProductId id = product(item);
+        delivered_flag(item) = 1;
+        find_demand(id)->remaining--;
+        m_remaining_items--;
+        m_remaining_weight -= m_lines->weights[id];
+
+        while (m_cursor < m_item_count && delivered_flag(m_cursor))
+            m_cursor++;
+    }
+
+    // Marks the first undelivered item of the product as delivered.
+    void mark_as_delivered(ProductId id) {
+        if (!complete() && product(m_cursor) == id) {
+            mark_item_as_delivered(m_cursor);
+            return;
+        }
+
+        Demand* demand = find_demand(id);
+        if (!demand || !demand->remaining)
+            return;
+
+        const uint32_t* items = m_lines->items_by_product.data() + m_first_item;
+        while (delivered_flag(items[demand->next]))
+            demand->next++;
+        mark_item_as_delivered(items[demand->next]);
+    }
+};
+
+class Drone {
+public:
+    DroneId id;
+    Point position;
+
+    std::vector<ProductId> current_products;
+    size_t expected_unbusy_turn;
+
+    explicit Drone(DroneId id, size_t x, size_t y): id(id), position(x, y), expected_unbusy_turn(0) {}
+
+    bool unbusy(size_t current_turn) const {
+        return expected_unbusy_turn <= current_turn;
+    }
+
+};
+
+class Simulation {
+public:
+    size_t m_current_turn;
+    size_t m_width;
+    size_t m_height;
+    size_t m_turns_deadline;
+    size_t m_drone_max_load;
+
+    std::vector<Drone> m_drones;
+
+    std::vector<Product> m_products;
+
+    std::vector<Warehouse> m_warehouses;
+
+    std::vector<Order> m_orders;
+
+    // The items of every order. The orders point to it, see the copy
+    // constructor.
+    OrderLines m_order_lines;
+
+    // Spatial indices over the warehouses, drones and pending order
+    // destinations, see spatial_index.h.
+    SpatialIndex m_warehouse_index;
+    SpatialIndex m_drone_index;
+    SpatialIndex m_order_index;
+
+    // The stock of every warehouse, and which warehouses have each product.
+    // The warehouses point to it, see the copy constructor.
+    Inventory m_inventory;
+
+    // Precomputed distances between warehouses and order destinations. They
+    // never change, so copies share them.
+    std::shared_ptr<const DistanceTables> m_distances;
+
+    // Query counts and timings, see instrumentation.h. Mutable so the const
+    // queries count too.
+    mutable Instrumentation m_instrumentation;
+
+    // Under this many holders it's cheaper to just go through them than to
+    // walk the grid.
+    static const size_t HOLDER_SCAN_THRESHOLD = 32;
+
+    // Parses the input file, throwing a ParseError if it's malformed.
+    explicit Simulation(const char* path);
+
+    void print_summary(std::ostream& out) const {
+        out << "(" << m_width << ", " << m_height << ")" << std::endl;
+        out << m_turns_deadline << " turns" << std::endl;
+        out << m_drones.size() << " drones" << std::endl;
+        out << m_warehouses.size() << " warehouses" << std::endl;
+        out << m_products.size() << " products" << std::endl;
+        out << m_orders.size() << " orders" << std::endl;
+    }
+
+    // Copies get their own drones, orders and stock, so that several plans
+    // can be built from the same parsed input.
+    Simulation(const Simulation& other)
+        : m_current_turn(other.m_current_turn)
+        , m_width(other.m_width)
+        , m_height(other.m_height)
+        , m_turns_deadline(other.m_turns_deadline)
+        , m_drone_max_load(other.m_drone_max_load)
+        , m_drones(other.m_drones)
+        , m_products(other.m_products)
+        , m_warehouses(other.m_warehouses)
+        , m_orders(other.m_orders)
+        , m_order_lines(other.m_order_lines)
+        , m_warehouse_index(other.m_warehouse_index)
+        , m_drone_index(other.m_drone_index)
+        , m_order_index(other.m_order_index)
+        , m_inventory(other.m_inventory)
+        , m_distances(other.m_distances)
+        , m_instrumentation(other.m_instrumentation) {
+        for (auto& warehouse: m_warehouses)
+            warehouse.m_inventory = &m_inventory;
+        for (auto& order: m_orders)
+            order.attach(&m_order_lines);
+    }
+
+    Simulation& operator=(const Simulation&) = delete;
+
+    // With `max_distance`, only drones at most that far are considered.
+    DroneId nearest_unbusy_drone(const Point& point, bool prefer_greatest_id = true,
+                                 size_t max_distance = INVALID) {
+        Instrumentation::Scope scope(m_instrumentation, Instrumentation::NEAREST_DRONE);
+        m_instrumentation.count(Instrumentation::DRONE_QUERIES);
+        return find_unbusy_drone(point, prefer_greatest_id, max_distance);
+    }
+
+    Warehouse& nearest_warehouse_with_product(const Order& order, ProductId product) {
+        Instrumentation::Scope scope(m_instrumentation, Instrumentation::NEAREST_WAREHOUSE);
+        m_instrumentation.count(Instrumentation::NEAREST_WAREHOUSE_QUERIES);
+        return m_warehouses[find_warehouse_with_product(order, product)];
+    }
+
+    // The two above without the counters and timers, which aren't thread
+    // safe, so several threads can ask at once as long as nobody changes
+    // anything meanwhile.
+    DroneId find_unbusy_drone(const Point& point, bool prefer_greatest_id = true,
+                              size_t max_distance = INVALID) const {
+        return m_drone_index.nearest(point, [this](DroneId id) {
+            return m_drones[id].unbusy(m_current_turn);
+        }, prefer_greatest_id, max_distance);
+    }
+
+    WarehouseId find_warehouse_with_product(const Order& order, ProductId product) const {
+        const auto& holders = m_inventory.holders(product);
+        assert(!holders.empty());
+
+        WarehouseId id = INVALID;
+        if (holders.size() <= HOLDER_SCAN_THRESHOLD) {
+            size_t distance = INVALID;
+            for (auto holder: holders) {
+                size_t current_dist = m_distances->warehouse_to_order(holder, order.id);
+                if (current_dist < distance || (current_dist == distance && holder > id)) {
+                    distance = current_dist;
+                    id = holder;
+                }
+            }
+        } else {
+            id = m_warehouse_index.nearest(order.destination, [this, product](WarehouseId id) {
+                return m_warehouses[id].has(product);
+            });
+        }
+
+        assert(id != INVALID);
+        return id;
+    }
+
+    // Pending order nearest to `point`, at most `max_distance` away, for which
+    // `pred` holds.
+    template<typename Predicate>
+    OrderId nearest_pending_order(const Point& point, size_t max_distance, Predicate pred) const {
+        Instrumentation::Scope scope(m_instrumentation, Instrumentation::NEAREST_ORDER);
+        m_instrumentation.count(Instrumentation::ORDER_QUERIES);
+        return m_order_index.nearest(point, pred, true, max_distance);
+    }
+
+    // Forgets about a complete order.
+    void retire_order(OrderId id) {
+        assert(m_orders[id].complete());
+        m_order_index.remove(id);
+    }
+
+    void move_drone(DroneId id, const Point& position) {
+        m_drones[id].position = position;
+        m_drone_index.move(id, position);
+    }
+};
+
+inline Simulation::Simulation(const char* path)
+    : m_current_turn(0)
+    , m_warehouse_index(0, 0, 1)
+    , m_drone_index(0, 0, 1)
+    , m_order_index(0, 0, 1) {
+    InputParser in(path);
+
+    // Ids and counts are 32 bits, with INVALID as the sentinel, and
+    // coordinates have to fit the distance kernels. Other than that, there's
+    // no limit. We reserve at most one entry per byte of input, so a bogus
+    // count runs out of input instead of memory.
+    m_height = in.number_below("row count", MAX_KERNEL_COORDINATE + 1);
+    m_width = in.number_below("column count", MAX_KERNEL_COORDINATE + 1);
+    size_t drone_count = in.number_below("drone count", INVALID);
+    m_drones.reserve(std::min(drone_count, in.size()));
+    m_turns_deadline = in.number("deadline");
+    m_drone_max_load = in.number("maximum load");
+
+    size_t product_count = in.number_below("product count", INVALID);
+    m_products.reserve(std::min(product_count, in.size()));
+    m_order_lines.weights.reserve(m_products.capacity());
+
+    for (size_t i = 0; i < product_count; i++) {
+        size_t weight = in.number_below("product weight", std::min<size_t>(m_drone_max_load, UINT32_MAX) + 1);
+        m_products.push_back(Product(i, weight));
+        m_order_lines.weights.push_back(m_products.back().weight);
+    }
+
+    size_t warehouse_count = in.number_below("warehouse count", INVALID);
+    size_t warehouse_count_offset = in.offset();
+    m_warehouses.reserve(std::min(warehouse_count, in.size()));
+    // Every warehouse has a stock line, so this one can't be bogus for long
+    // either.
+    if (warehouse_count && product_count > in.size() / warehouse_count)
+        in.fail("more stock than there is input", warehouse_count_offset);
+    m_inventory = Inventory(warehouse_count, product_count);
+
+    for (size_t i = 0; i < warehouse_count; i++) {
+        size_t y = in.number_below("warehouse row", m_height);
+        size_t x = in.number_below("warehouse column", m_width);
+
+        Warehouse this_warehouse(i, x, y, &m_inventory);
+        for (auto& product: m_products)
+            this_warehouse.add_product(product.id, in.number_below("stock", size_t(UINT32_MAX) + 1));
+
+        m_warehouses.push_back(this_warehouse);
+    }
+
+    if (m_warehouses.empty())
+        in.fail("there must be at least one warehouse", warehouse_count_offset);
+
+    size_t order_count = in.number_below("order count", INVALID);
+    m_orders.reserve(std::min(order_count, in.size()));
+
+    std::vector<ProductId> products;
+
+    for (size_t i = 0; i < order_count; i++) {
+        // Rows first, like the warehouses.
+        size_t y = in.number_below("order row", m_height);
+        size_t x = in.number_below("order column", m_width);
+
+        size_t item_count_offset = in.offset();
+        size_t item_count = in.number("order item count");
+        if (item_count >= INVALID - m_order_lines.products.size())
+            in.fail("too many items", item_count_offset);
+
+        products.clear();
+        for (size_t j = 0; j < item_count; j++)
+            products.push_back(in.number_below("product id", product_count));
+
+        m_orders.push_back(Order(i, x, y, products.data(), products.size(), m_order_lines));
+    }
+
+    in.expect_end();
+
+    for (size_t i = 0; i < drone_count; i++) {
+        m_drones.push_back(Drone(i, m_warehouses[0].position.x, m_warehouses[0].position.y));
+    }
+
+    m_warehouse_index = SpatialIndex(m_width, m_height, m_warehouses.size());
+    for (auto& warehouse: m_warehouses)
+        m_warehouse_index.insert(warehouse.id, warehouse.position);
+
+    m_drone_index = SpatialIndex(m_width, m_height, m_drones.size());
+    for (auto& drone: m_drones)
+        m_drone_index.insert(drone.id, drone.position);
+
+    m_order_index = SpatialIndex(m_width, m_height, m_orders.size());
+    for (auto& order: m_orders) {
+        m_order_index.insert(order.id, order.destination);
+        if (order.complete())
+            m_order_index.remove(order.id);
+    }
+
+    {
+        std::vector<Point> warehouses, destinations;
+        for (auto& warehouse: m_warehouses)
+            warehouses.push_back(warehouse.position);
+        for (auto& order: m_orders)
+            destinations.push_back(order.destination);
+        m_distances = std::make_shared<DistanceTables>(warehouses, destinations);
+    }
+}
+
+#endif
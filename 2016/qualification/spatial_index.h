@@ -0,0 +1,181 @@
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "point.h"
+#include "distance.h"
+
+// Uniform grid over the map, used to answer "nearest thing satisfying X"
+// queries without looking at every single warehouse or drone.
+//
+// Ids must be dense and inserted in order (they're the warehouse or drone
+// ids). Ties in distance are resolved in favour of the greatest id by default,
+// which is what the old linear scans did.
+class SpatialIndex {
+    // Coordinates are kept next to the ids so the distances to a whole cell
+    // can go through the batched kernel.
+    struct Cell {
+        std::vector<uint32_t> ids;
+        std::vector<int32_t> xs;
+        std::vector<int32_t> ys;
+    };
+
+    size_t m_cell_size;
+    size_t m_columns;
+    size_t m_rows;
+    std::vector<Cell> m_cells;
+    std::vector<Point> m_positions;
+    std::vector<uint32_t> m_cell_of;
+
+    size_t column_for(size_t x) const {
+        return std::min(x / m_cell_size, m_columns - 1);
+    }
+
+    size_t row_for(size_t y) const {
+        return std::min(y / m_cell_size, m_rows - 1);
+    }
+
+    void add_to_cell(size_t id) {
+        const Point& p = m_positions[id];
+        size_t cell = row_for(p.y) * m_columns + column_for(p.x);
+        m_cells[cell].ids.push_back(static_cast<uint32_t>(id));
+        m_cells[cell].xs.push_back(static_cast<int32_t>(p.x));
+        m_cells[cell].ys.push_back(static_cast<int32_t>(p.y));
+        m_cell_of[id] = static_cast<uint32_t>(cell);
+    }
+
+    void remove_from_cell(size_t id) {
+        auto& cell = m_cells[m_cell_of[id]];
+        auto it = std::find(cell.ids.begin(), cell.ids.end(), id);
+        assert(it != cell.ids.end());
+        size_t slot = it - cell.ids.begin();
+        cell.ids[slot] = cell.ids.back();
+        cell.xs[slot] = cell.xs.back();
+        cell.ys[slot] = cell.ys.back();
+        cell.ids.pop_back();
+        cell.xs.pop_back();
+        cell.ys.pop_back();
+    }
+
+    template<typename Predicate>
+    void visit_cell(size_t column, size_t row, const Point& point,
+                    Predicate& pred, bool prefer_greatest_id,
+                    size_t& best, size_t& best_distance) const {
+        const Cell& cell = m_cells[row * m_columns + column];
+        const size_t CHUNK = 64;
+        uint32_t distances[CHUNK];
+
+        for (size_t start = 0; start < cell.ids.size(); start += CHUNK) {
+            size_t count = std::min(CHUNK, cell.ids.size() - start);
+            distances_from(point.x, point.y,
+                           &cell.xs[start], &cell.ys[start],
+                           count, distances);
+
+            for (size_t i = 0; i < count; ++i) {
+                size_t id = cell.ids[start + i];
+                size_t distance = distances[i];
+                if (distance > best_distance)
+                    continue;
+                if (distance == best_distance && best != INVALID &&
+                    (prefer_greatest_id ? id < best : id > best))
+                    continue;
+                if (!pred(id))
+                    continue;
+                best = id;
+                best_distance = distance;
+            }
+        }
+    }
+
+public:
+    // The cell size is chosen so that there's around one item per cell if
+    // they were evenly spread.
+    explicit SpatialIndex(size_t width, size_t height, size_t expected_count) {
+        width = std::max<size_t>(width, 1);
+        height = std::max<size_t>(height, 1);
+        expected_count = std::max<size_t>(expected_count, 1);
+
+        double area_per_item = double(width) * double(height) / double(expected_count);
+        m_cell_size = std::max<size_t>(1, static_cast<size_t>(ceil(sqrt(area_per_item))));
+        m_columns = (width + m_cell_size - 1) / m_cell_size;
+        m_rows = (height + m_cell_size - 1) / m_cell_size;
+        m_cells.resize(m_columns * m_rows);
+        m_positions.reserve(expected_count);
+        m_cell_of.reserve(expected_count);
+    }
+
+    void insert(size_t id, const Point& position) {
+        assert(id == m_positions.size());
+        assert(position.x < MAX_KERNEL_COORDINATE && position.y < MAX_KERNEL_COORDINATE);
+        m_positions.push_back(position);
+        m_cell_of.push_back(INVALID);
+        add_to_cell(id);
+    }
+
+    void move(size_t id, const Point& position) {
+        assert(id < m_positions.size() && m_cell_of[id] != INVALID);
+        assert(position.x < MAX_KERNEL_COORDINATE && position.y < MAX_KERNEL_COORDINATE);
+        remove_from_cell(id);
+        m_positions[id] = position;
+        add_to_cell(id);
+    }
+
+    // Takes the id out of the index for good.
+    void remove(size_t id) {
+        assert(id < m_positions.size());
+        if (m_cell_of[id] == INVALID)
+            return;
+        remove_from_cell(id);
+        m_cell_of[id] = INVALID;
+    }
+
+    // Returns the nearest id for which `pred(id)` holds, or INVALID. With
+    // `max_distance`, only ids at most that far are considered.
+    //
+    // We walk rings of cells around the one containing `point`. Anything in
+    // ring r is at least (r - 1) * cell_size + 1 away, so once that's past
+    // the best distance found there's nothing left to improve.
+    template<typename Predicate>
+    size_t nearest(const Point& point, Predicate pred, bool prefer_greatest_id = true,
+                   size_t max_distance = INVALID) const {
+        size_t best = INVALID;
+        size_t best_distance = max_distance;
+
+        size_t cx = column_for(point.x);
+        size_t cy = row_for(point.y);
+        size_t max_ring = std::max(m_columns, m_rows);
+
+        for (size_t ring = 0; ring < max_ring; ++ring) {
+            if (ring > 0 && (ring - 1) * m_cell_size + 1 > best_distance)
+                break;
+
+            size_t min_x = cx >= ring ? cx - ring : 0;
+            size_t max_x = std::min(cx + ring, m_columns - 1);
+            size_t min_y = cy >= ring ? cy - ring : 0;
+            size_t max_y = std::min(cy + ring, m_rows - 1);
+
+            for (size_t y = min_y; y <= max_y; ++y) {
+                bool edge_row = y + ring == cy || y == cy + ring;
+                if (edge_row) {
+                    for (size_t x = min_x; x <= max_x; ++x)
+                        visit_cell(x, y, point, pred, prefer_greatest_id, best, best_distance);
+                    continue;
+                }
+
+                // Only the left and right borders of the ring.
+                if (cx >= ring)
+                    visit_cell(cx - ring, y, point, pred, prefer_greatest_id, best, best_distance);
+                if (ring > 0 && cx + ring < m_columns)
+                    visit_cell(cx + ring, y, point, pred, prefer_greatest_id, best, best_distance);
+            }
+        }
+
+        return best;
+    }
+};
+
+#endif